@@ -8,47 +8,80 @@
 
 #define STACK_MEMBERS 			1024
 #define HEAP_MEMBERS 			1024
-#define MAX_LABELS 			200
-#define MAX_LABEL_LENGTH 		500
+#define LABEL_SLOTS 			256
 #define MAX_INSTRUCTIONS 		24
 #define MAX_INSTRUCTION_LENGTH 	        5
-#define MAX_NESTED_SUBROUTINES	        20
+#define NESTED_SUBROUTINES	        64
+#define UNRESOLVED_LABEL		-1
 
 /* Notes
 	This entire code depends heavily on the ASCII character set
-	I am aware that I could have incremented instruction_index in the step through function, however it makes more sense to me to do it
-		in the actual instruction.
-	MAX_LABEL_LENGTH also applies to maximum length for a number (in bits or whitespace characters)
-	The plan was to use dynamic memory allocation throughout the entire project, but I ran into a couple sections where I kept getting mem bugs that I couldn't fix,
-		so I had to switch to static allocation in those areas
+	STACK_MEMBERS, HEAP_MEMBERS, LABEL_SLOTS and NESTED_SUBROUTINES are only the starting sizes, everything doubles when it fills up
+	The heap and the labels are hash tables (open addressing, linear probing) that are kept at most half full
+	The source is decoded once into the program array before it runs: every instruction gets its opcode, its number already converted
+		and its jump target already resolved to an index into the array, so running it never looks at the source text again
 */
 
+// The stack grows upwards, current is the number of members
 struct stack_model {
 	long size;
 	long current;
 	long long* contents;
 } stack;
 
+// The return addresses of the calls that are running
+struct call_model {
+	long size;
+	long current;
+	long long* address;
+} calls;
+
 struct heap_model {
 	long long* address;
 	long long* value;
+	bool* used;
+	long size;		// always a power of two
 	long elements;
 } heap;
 
+// Every label text is interned once, after that a label is just its id
 struct label_model {
-	char** label_id;
-	int* label_location;
-	int total_labels;
+	char** label_id;	// text of every label, by id
+	long* label_location;	// index of the mark of every label, by id
+	long total_labels;
+	long capacity;
+	long* slot;		// hash table of ids, -1 is empty
+	long slots;		// always a power of two
 } label_table;
 
+// The opcode of an instruction is its index in instruction_set
+enum opcode {
+	WS_STACK_PUSH, WS_STACK_DUP, WS_STACK_COPY, WS_STACK_SWAP, WS_STACK_DISCARD, WS_STACK_SLIDE,
+	WS_MATH_ADD, WS_MATH_SUB, WS_MATH_MULT, WS_MATH_DIV, WS_MATH_MOD,
+	WS_HEAP_STORE, WS_HEAP_RETRIEVE,
+	WS_FLOW_MARK, WS_FLOW_CALL, WS_FLOW_JUMP, WS_FLOW_JZ, WS_FLOW_JN, WS_FLOW_RET, WS_FLOW_EXIT,
+	WS_IO_OUTC, WS_IO_OUTN, WS_IO_INC, WS_IO_INN,
+	WS_UNKNOWN
+};
+
 struct instruction_model {
 	char** unique_id;
-	void (**instruction_function)(char * parameter, int size);
 	int* instruction_size;
 } instruction_set;
 
-// This is really just going to be a stack
-long long instruction_index[MAX_NESTED_SUBROUTINES];
+// One decoded instruction, argument is the number for push/copy/slide and the index of the target for call/jumps
+// (until locate_jump_labels runs it is the id of the label)
+struct decoded_instruction {
+	int opcode;
+	long long argument;
+};
+
+struct program_model {
+	struct decoded_instruction* code;
+	long size;
+	long capacity;
+} program;
+
 long long current_instruction_index;
 
 // All the background/foundation functions
@@ -57,48 +90,30 @@ void remove_comments(char* buffer);
 bool create_stack(void);
 bool stack_push(long long val);
 long long stack_pop(void);
-long long stack_peak(int depth);
+long long stack_peak(long long depth);
 void cleanup_stack(void);
 bool create_heap(void);
 long long heap_get(long long addr);
 bool heap_put(long long val, long long addr);
+long heap_slot(long long addr, long size);
+bool heap_grow(void);
 void cleanup_heap(void);
 bool create_label_table(void);
+long label_slot(char* label, long slots);
+bool label_grow(void);
+long intern_label(char* label);
 void cleanup_label_table(void);
 bool create_instruction_set(void);
 void cleanup_instruction_set(void);
-bool locate_jump_labels(char * source);
+bool add_instruction(int opcode, long long argument);
+bool decode_program(char* source);
+bool locate_jump_labels(void);
+void cleanup_program(void);
 long long convert_ws_to_number(char * ws);
 int retrieve_label_or_number(char* data, char** ret);
 bool add_ret_addr(long long addr);
 long long get_last_ret_addr(void);
-void step_through_program(char * source);
-
-// All the functions representing actual whitespace instructions
-void ws_stack_push(char* parameter, int size);
-void ws_stack_dup(char* parameter, int size);
-void ws_stack_copy(char* parameter, int size);
-void ws_stack_swap(char* parameter, int size);
-void ws_stack_discard(char* parameter, int size);
-void ws_stack_slide(char* parameter, int size);
-void ws_math_add(char* parameter, int size);
-void ws_math_sub(char* parameter, int size);
-void ws_math_mult(char* parameter, int size);
-void ws_math_div(char* parameter, int size);
-void ws_math_mod(char* parameter, int size);
-void ws_heap_store(char* parameter, int size);
-void ws_heap_retrieve(char* parameter, int size);
-void ws_flow_mark(char* parameter, int size);
-void ws_flow_call(char* parameter, int size);
-void ws_flow_jump(char* parameter, int size);
-void ws_flow_jz(char* parameter, int size);
-void ws_flow_jn(char* parameter, int size);
-void ws_flow_ret(char* parameter, int size);
-void ws_flow_exit(char* parameter, int size);
-void ws_io_outc(char* parameter, int size);
-void ws_io_outn(char* parameter, int size);
-void ws_io_inc(char* parameter, int size);
-void ws_io_inn(char* parameter, int size);
+void step_through_program(void);
 
 int main(int argc, char** argv)
 {
@@ -110,16 +125,18 @@ int main(int argc, char** argv)
 				if (create_heap()) {
 					if (create_label_table()) {
 						if (create_instruction_set()) {
-							if (locate_jump_labels(source)) {
-								step_through_program(source);
-
+							if (decode_program(source) && locate_jump_labels()) {
 								free (source);
+								step_through_program();
+
+								cleanup_program();
 								cleanup_stack();
 								cleanup_heap();
 								cleanup_label_table();
 								cleanup_instruction_set();
 								return 0;
 							}
+							cleanup_program();
 							cleanup_instruction_set();
 						}
 						cleanup_label_table();
@@ -162,49 +179,52 @@ void remove_comments(char* buffer)
 {
 	int j = 0;
 	for (int i = 0; buffer[i]; i++) {
-		if (buffer[i] != '\x09' && buffer[i] != '\x0A' && buffer[i] != '\x20') {
-			memmove(&(buffer[i]), &(buffer[i+1]), strlen(&(buffer[i+1])));
-			i--;
-			j++;
-		}
+		if (buffer[i] == '\x09' || buffer[i] == '\x0A' || buffer[i] == '\x20')
+			buffer[j++] = buffer[i];
 	}
-	buffer[strlen(buffer) - j] = 0;
+	buffer[j] = 0;
 	return;
 }
 
 bool create_stack(void)
 {
 	if (stack.contents = (long long*)calloc(STACK_MEMBERS, sizeof(long long))) {
-		stack.size = STACK_MEMBERS;
-		stack.current = STACK_MEMBERS;
-		return true;
+		if (calls.address = (long long*)calloc(NESTED_SUBROUTINES, sizeof(long long))) {
+			stack.size = STACK_MEMBERS;
+			stack.current = 0;
+			calls.size = NESTED_SUBROUTINES;
+			calls.current = 0;
+			return true;
+		}
+		free (stack.contents);
 	} 
 	return false;
 }
 
 bool stack_push(long long val)
 {
-	if (stack.current >= 1) {
-		stack.current--;
-		stack.contents[stack.current] = val;
-		return true;
+	if (stack.current == stack.size) {
+		long long* contents = (long long*)realloc(stack.contents, stack.size * 2 * sizeof(long long));
+		if (!contents) return false;
+		stack.contents = contents;
+		stack.size *= 2;
 	}
-	return false;
+	stack.contents[stack.current++] = val;
+	return true;
 }
 
 long long stack_pop(void)
 {
-	if (stack.current < stack.size) {
-		stack.current++;
-		return stack.contents[stack.current - 1];
+	if (stack.current > 0) {
+		return stack.contents[--stack.current];
 	}
 	return 0;
 }
 
-long long stack_peak(int depth)
+long long stack_peak(long long depth)
 {
-	if ((stack.current + depth) < stack.size) {
-		return stack.contents[stack.current + depth];
+	if (depth >= 0 && depth < stack.current) {
+		return stack.contents[stack.current - 1 - depth];
 	}
 	return 0;
 }
@@ -212,6 +232,7 @@ long long stack_peak(int depth)
 void cleanup_stack(void)
 {
 	free (stack.contents);
+	free (calls.address);
 	return;
 }
 
@@ -219,40 +240,80 @@ bool create_heap(void)
 {
 	if (heap.address = (long long*)calloc(HEAP_MEMBERS, sizeof(long long))) {
 		if (heap.value = (long long*)calloc(HEAP_MEMBERS, sizeof(long long))) {
-			heap.elements = 0;
-			return true;
+			if (heap.used = (bool*)calloc(HEAP_MEMBERS, sizeof(bool))) {
+				heap.size = HEAP_MEMBERS;
+				heap.elements = 0;
+				return true;
+			}
+			free (heap.value);
 		}
 		free (heap.address);
 	}
 	return false;
 }
 
+// Addresses tend to be small and close together, the multiplication spreads them over the whole table
+long heap_slot(long long addr, long size)
+{
+	unsigned long long h = (unsigned long long)addr * 0x9E3779B97F4A7C15ULL;
+	return (long)(h >> 32) & (size - 1);
+}
+
+bool heap_grow(void)
+{
+	long size = heap.size * 2, i, j;
+	long long* address = (long long*)calloc(size, sizeof(long long));
+	long long* value = (long long*)calloc(size, sizeof(long long));
+	bool* used = (bool*)calloc(size, sizeof(bool));
+	if (!address || !value || !used) {
+		free (address);
+		free (value);
+		free (used);
+		return false;
+	}
+	for (i = 0; i < heap.size; i++) {
+		if (heap.used[i]) {
+			for (j = heap_slot(heap.address[i], size); used[j]; j = (j + 1) & (size - 1));
+			address[j] = heap.address[i];
+			value[j] = heap.value[i];
+			used[j] = true;
+		}
+	}
+	cleanup_heap();
+	heap.address = address;
+	heap.value = value;
+	heap.used = used;
+	heap.size = size;
+	return true;
+}
+
 bool heap_put(long long val, long long addr)
 {
+	long i;
 	// First see if the address is already in use
-	for (int i = 0; i < heap.elements; i++) {
+	for (i = heap_slot(addr, heap.size); heap.used[i]; i = (i + 1) & (heap.size - 1)) {
 		if (heap.address[i] == addr) {
 			heap.value[i] = val;
 			return true;
 		}
 	}
 	
-	// If not, then it needs to be added if there is room left
-	if (heap.elements < HEAP_MEMBERS) {
-		int i = heap.elements;
-		heap.address[i] = addr;
-		heap.value[i] = val;
-		heap.elements++;
-		return true;
+	// If not, then it needs to be added, and the table grows first if that would make it more than half full
+	if ((heap.elements + 1) * 2 > heap.size) {
+		if (!heap_grow()) return false;
+		for (i = heap_slot(addr, heap.size); heap.used[i]; i = (i + 1) & (heap.size - 1));
 	}
-	
-	return false;
+	heap.address[i] = addr;
+	heap.value[i] = val;
+	heap.used[i] = true;
+	heap.elements++;
+	return true;
 }
 
 // Trying to get data from an address that doesn't exist results in 0 being returned
 long long heap_get(long long addr)
 {
-	for (int i = 0; i < HEAP_MEMBERS; i++) {
+	for (long i = heap_slot(addr, heap.size); heap.used[i]; i = (i + 1) & (heap.size - 1)) {
 		if (heap.address[i] == addr) return heap.value[i];
 	}
 	return 0;
@@ -262,26 +323,89 @@ void cleanup_heap(void)
 {
 	free (heap.address);
 	free (heap.value);
+	free (heap.used);
 	return;
 }
 
 bool create_label_table(void)
 {
-	if (label_table.label_id = (char**)calloc(MAX_LABELS, sizeof(char*))) {
-		if (label_table.label_location = (int*)calloc(MAX_LABELS, sizeof(int))) {
-			return true;
-		}
-		free (label_table.label_id);
+	if (label_table.slot = (long*)malloc(LABEL_SLOTS * sizeof(long))) {
+		memset(label_table.slot, -1, LABEL_SLOTS * sizeof(long));
+		label_table.slots = LABEL_SLOTS;
+		label_table.label_id = NULL;
+		label_table.label_location = NULL;
+		label_table.total_labels = 0;
+		label_table.capacity = 0;
+		return true;
 	}
 	return false;
 }
 
+// fnv-1a
+long label_slot(char* label, long slots)
+{
+	unsigned long h = 2166136261UL;
+	for (; *label; label++)
+		h = (h ^ (unsigned char)*label) * 16777619UL;
+	return (long)(h & (slots - 1));
+}
+
+bool label_grow(void)
+{
+	long slots = label_table.slots * 2, i, j;
+	long* slot = (long*)malloc(slots * sizeof(long));
+	if (!slot) return false;
+	memset(slot, -1, slots * sizeof(long));
+	for (i = 0; i < label_table.total_labels; i++) {
+		for (j = label_slot(label_table.label_id[i], slots); slot[j] != -1; j = (j + 1) & (slots - 1));
+		slot[j] = i;
+	}
+	free (label_table.slot);
+	label_table.slot = slot;
+	label_table.slots = slots;
+	return true;
+}
+
+// Returns the id of label, or -1 if we ran out of memory
+// The table takes label over, if the text is known already it is freed right away
+long intern_label(char* label)
+{
+	long i, id;
+	for (i = label_slot(label, label_table.slots); (id = label_table.slot[i]) != -1; i = (i + 1) & (label_table.slots - 1)) {
+		if (!strcmp(label_table.label_id[id], label)) {
+			free (label);
+			return id;
+		}
+	}
+
+	if (label_table.total_labels == label_table.capacity) {
+		long capacity = label_table.capacity ? label_table.capacity * 2 : LABEL_SLOTS;
+		char** label_id = (char**)realloc(label_table.label_id, capacity * sizeof(char*));
+		long* label_location;
+		if (!label_id) return -1;
+		label_table.label_id = label_id;
+		if (!(label_location = (long*)realloc(label_table.label_location, capacity * sizeof(long)))) return -1;
+		label_table.label_location = label_location;
+		label_table.capacity = capacity;
+	}
+	if ((label_table.total_labels + 1) * 2 > label_table.slots) {
+		if (!label_grow()) return -1;
+		for (i = label_slot(label, label_table.slots); label_table.slot[i] != -1; i = (i + 1) & (label_table.slots - 1));
+	}
+	id = label_table.total_labels++;
+	label_table.label_id[id] = label;
+	label_table.label_location[id] = UNRESOLVED_LABEL;
+	label_table.slot[i] = id;
+	return id;
+}
+
 void cleanup_label_table(void)
 {
-	for (int i = 0; i < MAX_LABELS && label_table.label_location[i]; i++)
+	for (long i = 0; i < label_table.total_labels; i++)
 		free (label_table.label_id[i]);
 	free (label_table.label_id);
 	free (label_table.label_location);
+	free (label_table.slot);
 	return;
 }
 
@@ -292,475 +416,357 @@ bool create_instruction_set(void)
 {
 	instruction_set.unique_id = calloc(MAX_INSTRUCTIONS, sizeof(char*));
 	instruction_set.instruction_size = calloc(MAX_INSTRUCTIONS, sizeof(int));
-	instruction_set.instruction_function = calloc(MAX_INSTRUCTIONS, sizeof(void(*)(char *, int)));
-	// Here we put all of the instruction ids and functions
+	// Here we put all of the instruction ids, in the order of enum opcode
 
 	// Stack Manipulation - [SPACE]
 	instruction_set.unique_id[0] = "\x20\x20";
-	instruction_set.instruction_function[0] = &ws_stack_push;
 	instruction_set.instruction_size[0] = 2;
 
 	instruction_set.unique_id[1] = "\x20\x0A\x20";
-	instruction_set.instruction_function[1] = &ws_stack_dup;
 	instruction_set.instruction_size[1] = 3;
 
 	instruction_set.unique_id[2] = "\x20\x09\x20";
-	instruction_set.instruction_function[2] = &ws_stack_copy;
 	instruction_set.instruction_size[2] = 3;
 
 	instruction_set.unique_id[3] = "\x20\x0A\x09";
-	instruction_set.instruction_function[3] = &ws_stack_swap;
 	instruction_set.instruction_size[3] = 3;
 
 	instruction_set.unique_id[4] = "\x20\x0A\x0A";
-	instruction_set.instruction_function[4] = &ws_stack_discard;
 	instruction_set.instruction_size[4] = 3;
 
 	instruction_set.unique_id[5] = "\x20\x09\x0A";
-	instruction_set.instruction_function[5] = &ws_stack_slide;
 	instruction_set.instruction_size[5] = 3;
 
 	// Arithmetic - [Tab][Space]
 	instruction_set.unique_id[6] = "\x09\x20\x20\x20";
-	instruction_set.instruction_function[6] = &ws_math_add;
 	instruction_set.instruction_size[6] = 4;
 
 	instruction_set.unique_id[7] = "\x09\x20\x20\x09";
-	instruction_set.instruction_function[7] = &ws_math_sub;
 	instruction_set.instruction_size[7] = 4;
 
 	instruction_set.unique_id[8] = "\x09\x20\x20\x0A";
-	instruction_set.instruction_function[8] = &ws_math_mult;
 	instruction_set.instruction_size[8] = 4;
 
 	instruction_set.unique_id[9] = "\x09\x20\x09\x20";
-	instruction_set.instruction_function[9] = &ws_math_div;
 	instruction_set.instruction_size[9] = 4;
 
 	instruction_set.unique_id[10] = "\x09\x20\x09\x09";
-	instruction_set.instruction_function[10] = &ws_math_mod;
 	instruction_set.instruction_size[10] = 4;
 
 	// Heap access - [Tab][Tab]
 	instruction_set.unique_id[11] = "\x09\x09\x20";
-	instruction_set.instruction_function[11] = &ws_heap_store;
 	instruction_set.instruction_size[11] = 3;
 
 	instruction_set.unique_id[12] = "\x09\x09\x09";
-	instruction_set.instruction_function[12] = &ws_heap_retrieve;
 	instruction_set.instruction_size[12] = 3;
 
 	// Flow Control - [LF]
 	instruction_set.unique_id[13] = "\x0A\x20\x20";
-	instruction_set.instruction_function[13] = &ws_flow_mark;
 	instruction_set.instruction_size[13] = 3;
 
 	instruction_set.unique_id[14] = "\x0A\x20\x09";
-	instruction_set.instruction_function[14] = &ws_flow_call;
 	instruction_set.instruction_size[14] = 3;
 
 	instruction_set.unique_id[15] = "\x0A\x20\x0A";
-	instruction_set.instruction_function[15] = &ws_flow_jump;
 	instruction_set.instruction_size[15] = 3;
 
 	instruction_set.unique_id[16] = "\x0A\x09\x20";
-	instruction_set.instruction_function[16] = &ws_flow_jz;
 	instruction_set.instruction_size[16] = 3;
 
 	instruction_set.unique_id[17] = "\x0A\x09\x09";
-	instruction_set.instruction_function[17] = &ws_flow_jn;
 	instruction_set.instruction_size[17] = 3;
 
 	instruction_set.unique_id[18] = "\x0A\x09\x0A";
-	instruction_set.instruction_function[18] = &ws_flow_ret;
 	instruction_set.instruction_size[18] = 3;
 
 	instruction_set.unique_id[19] = "\x0A\x0A\x0A";
-	instruction_set.instruction_function[19] = &ws_flow_exit;
 	instruction_set.instruction_size[19] = 3;
 
 	// Input/Output - [Tab][LF]
 	instruction_set.unique_id[20] = "\x09\x0A\x20\x20";
-	instruction_set.instruction_function[20] = &ws_io_outc;
 	instruction_set.instruction_size[20] = 4;
 
 	instruction_set.unique_id[21] = "\x09\x0A\x20\x09";
-	instruction_set.instruction_function[21] = &ws_io_outn;
 	instruction_set.instruction_size[21] = 4;
 
 	instruction_set.unique_id[22] = "\x09\x0A\x09\x20";
-	instruction_set.instruction_function[22] = &ws_io_inc;
 	instruction_set.instruction_size[22] = 4;
 
 	instruction_set.unique_id[23] = "\x09\x0A\x09\x09";
-	instruction_set.instruction_function[23] = &ws_io_inn;
 	instruction_set.instruction_size[23] = 4;
 	return true;
 }
 
 void cleanup_instruction_set(void)
 {
-	free (instruction_set.instruction_function);
 	free (instruction_set.unique_id);
 	free (instruction_set.instruction_size);
 	return;
 }
 
-/*
-	How to find labels.
-	1) A label is marked by [LF][SPACE][SPACE]
-	2) The character before the label can't be a [TAB]
-	3) Make sure you haven't found the representation of a label in a label
-*/
-bool locate_jump_labels(char* source)
+bool add_instruction(int opcode, long long argument)
 {
-	int label_index = 0, j, leap;
-	char* label_marker = "\x0A\x20\x20", * temp;
-	for (int i = 0; source[i]; i++) {
-		if (!strncmp(&(source[i]), label_marker, 3) && (source[i-1] != '\x09')) {
-			if (label_table.label_id[label_index] = (char*)calloc(MAX_LABEL_LENGTH, sizeof(char))) {
-				// Would look better if it used retrieve_label_or_number,
-				// but I'm having a hell of a time getting it to work
-				i += 3; // This gets us to the actual label
-				for (j = 0; source[i + j] != '\x0A'; j++) label_table.label_id[label_index][j] = source[i + j];
-				i += j;
-				label_table.label_location[label_index] = i + 1; // The 1 puts it past the final \x0A
-				label_index++;
-				continue;
-				
-			}
-			// If memory allocation breaks, then we need to report an error
-			return false;
-		}
+	if (program.size == program.capacity) {
+		long capacity = program.capacity ? program.capacity * 2 : 1024;
+		struct decoded_instruction* code = realloc(program.code, capacity * sizeof(struct decoded_instruction));
+		if (!code) return false;
+		program.code = code;
+		program.capacity = capacity;
 	}
-	label_table.total_labels = label_index;
+	program.code[program.size].opcode = opcode;
+	program.code[program.size].argument = argument;
+	program.size++;
 	return true;
 }
 
-bool add_ret_addr(long long addr)
-{
-	int i;
-	for (i = 0; i < MAX_NESTED_SUBROUTINES && instruction_index[i]; i++);
-	if (i < MAX_NESTED_SUBROUTINES) {
-		instruction_index[i] = addr;
-		return true;
-	}
-	else 
-		return false;
-}
-
-long long get_last_ret_addr(void)
-{
-	int i;
-	long long temp;
-	for (i = MAX_NESTED_SUBROUTINES - 1; !instruction_index[i] && i; i--);
-	temp = instruction_index[i];
-	instruction_index[i] = 0;
-	return temp;
-}
-
-void step_through_program(char* source)
+/*
+	Decoding walks the source the same way the old step through did:
+	1) Match the instruction ids at the current position, the first one that fits wins
+	2) Numbers and labels run up to the next [LF], an empty one is 0 or the empty label
+	3) Anything that matches nothing becomes WS_UNKNOWN and we try again one character later
+	4) Labels are interned as they come, the first mark of a label is the one that counts
+	Every mark remembers its own index, so jumping to it just runs on after the mark
+*/
+bool decode_program(char* source)
 {
-	int i;
-	while (current_instruction_index != -1 && source[current_instruction_index]) {
+	char* parameter;
+	int i, leap;
+	long position = 0, id;
+	while (source[position]) {
 		for (i = 0; i < MAX_INSTRUCTIONS; i++) {
-			if (!strncmp(&(source[current_instruction_index]), instruction_set.unique_id[i], instruction_set.instruction_size[i])) {
-				instruction_set.instruction_function[i](&(source[current_instruction_index]), instruction_set.instruction_size[i]);
+			if (!strncmp(&(source[position]), instruction_set.unique_id[i], instruction_set.instruction_size[i]))
 				break;
-			}
 		}
 		if (i == MAX_INSTRUCTIONS) {
-			current_instruction_index++;
-			getchar();
+			if (!add_instruction(WS_UNKNOWN, 0)) return false;
+			position++;
+			continue;
 		}
-	}
-	return;
-}
-
-// [SPACE] = bin(0), [TAB] = bin(1)
-// First 'space' represents signage, [SPACE] = positive, [TAB] = negative
-long long convert_ws_to_number(char* ws)
-{
-	long long amt = 0;
-	if (ws) {
-		int len = strlen(ws) - 1;
-		for (int i = 0; len > 0; len--, i++) {
-			if (ws[len] == '\x09') amt += (1 << i);
+		position += instruction_set.instruction_size[i];
+
+		switch (i) {
+			case WS_STACK_PUSH:
+			case WS_STACK_COPY:
+			case WS_STACK_SLIDE:
+				if (!(leap = retrieve_label_or_number(&(source[position]), &parameter)))
+					return true; // The number never ends, neither does the program
+				if (!add_instruction(i, convert_ws_to_number(parameter))) return false;
+				free (parameter);
+				position += leap;
+				break;
+			case WS_FLOW_MARK:
+			case WS_FLOW_CALL:
+			case WS_FLOW_JUMP:
+			case WS_FLOW_JZ:
+			case WS_FLOW_JN:
+				if (!(leap = retrieve_label_or_number(&(source[position]), &parameter)))
+					return true;
+				if ((id = intern_label(parameter)) == -1) return false;
+				if (i == WS_FLOW_MARK && label_table.label_location[id] == UNRESOLVED_LABEL)
+					label_table.label_location[id] = program.size;
+				if (!add_instruction(i, id)) return false;
+				position += leap;
+				break;
+			default:
+				if (!add_instruction(i, 0)) return false;
 		}
-		if (ws[0] == '\x09') amt = -amt;
 	}
-	return amt;
+	return true;
 }
 
-// This function returns the length of ret, which is the label or number
-int retrieve_label_or_number(char* data, char** ret)
+// Points every call and jump at the index of the mark of its label
+bool locate_jump_labels(void)
 {
-	char* loc;
-	if (*ret = (char*)calloc(MAX_LABEL_LENGTH + 1, sizeof(char))) {
-		strncpy(*ret, data, MAX_LABEL_LENGTH);
-		if (loc = strchr(*ret, '\x0A')) {
-			*loc = 0;
-			return strlen(*ret);
+	for (long i = 0; i < program.size; i++) {
+		switch (program.code[i].opcode) {
+			case WS_FLOW_CALL:
+			case WS_FLOW_JUMP:
+			case WS_FLOW_JZ:
+			case WS_FLOW_JN:
+				program.code[i].argument = label_table.label_location[program.code[i].argument];
 		}
-		free (*ret);
-	}
-	
-	return 0;
-}
-
-
-void ws_stack_push(char* parameter, int size)
-{
-	char* label_number = NULL;
-	int leap = 0;
-	if (leap = retrieve_label_or_number(&(parameter[size]), &label_number)) {
-		stack_push(convert_ws_to_number(label_number));
-		current_instruction_index += size + leap + 1;
-		free (label_number);
-	}
-	return;
-}
-
-void ws_stack_dup(char* parameter, int size)
-{
-	stack_push(stack_peak(0));
-	current_instruction_index += size;
-	return;
-}
-
-void ws_stack_copy(char* parameter, int size)
-{
-	char* label_number = NULL;
-	int leap = 0;
-	if (leap = retrieve_label_or_number(&(parameter[size]), &label_number)) {
-		stack_push(stack_peak(convert_ws_to_number(label_number)));
-		current_instruction_index += size + leap + 1;
-		free (label_number);
 	}
-	else
-		current_instruction_index += size;
-	return;
-}
-
-void ws_stack_swap(char* parameter, int size)
-{
-	long long first_off = stack_pop();
-	long long second_off = stack_pop();
-	stack_push(first_off);
-	stack_push(second_off);
-	current_instruction_index += size;
-	return;
+	return true;
 }
 
-void ws_stack_discard(char* parameter, int size)
+void cleanup_program(void)
 {
-	stack_pop();
-	current_instruction_index += size;
+	free (program.code);
 	return;
 }
 
-void ws_stack_slide(char* parameter, int size)
+bool add_ret_addr(long long addr)
 {
-	long long first = stack_pop();
-	int leap = 0;
-	char* label_number = NULL;
-	if (leap = retrieve_label_or_number(&(parameter[size]), &label_number)) {
-		for (int slide_amt = convert_ws_to_number(label_number); slide_amt > 0; slide_amt--)
-			stack_pop();
-		stack_push(first);
-		current_instruction_index += size + leap + 1;
-		free (label_number);
+	if (calls.current == calls.size) {
+		long long* address = (long long*)realloc(calls.address, calls.size * 2 * sizeof(long long));
+		if (!address) return false;
+		calls.address = address;
+		calls.size *= 2;
 	}
-	else
-		current_instruction_index += size;
-	return;
-}
-
-void ws_math_add(char* parameter, int size)
-{
-	long long right = stack_pop();
-	long long left = stack_pop();
-	stack_push(left + right);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_math_sub(char* parameter, int size)
-{
-	long long right = stack_pop();
-	long long left = stack_pop();
-	stack_push(left - right);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_math_mult(char* parameter, int size)
-{
-	long long right = stack_pop();
-	long long left = stack_pop();
-	stack_push(left * right);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_math_div(char* parameter, int size)
-{
-	long long right = stack_pop();
-	long long left = stack_pop();
-	stack_push(left / right);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_math_mod(char* parameter, int size)
-{
-	long long right = stack_pop();
-	long long left = stack_pop();
-	stack_push(left % right);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_heap_store(char* parameter, int size)
-{
-	long long value = stack_pop();
-	long long addr = stack_pop();
-	heap_put(value, addr);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_heap_retrieve(char* parameter, int size)
-{
-	stack_push(heap_get(stack_pop()));
-	current_instruction_index += size;
-	return;
-}
-
-void ws_flow_mark(char* parameter, int size)
-{
-	// For loop will stop once it gets to the second line feed
-	// Therefore we need one more increment after the fact
-	int i;
-	for (i = 1; parameter[i] != '\x0A'; i++);
-	current_instruction_index += i + 1;
-	return;
+	calls.address[calls.current++] = addr;
+	return true;
 }
 
-void ws_flow_call(char* parameter, int size)
+// A ret without a call goes back to the start, like it always did
+long long get_last_ret_addr(void)
 {
-	char* label;
-	int leap = 0;
-	if (leap = retrieve_label_or_number(&(parameter[size]), &label)) {
-		if (add_ret_addr(current_instruction_index + size + leap + 1)) {
-			ws_flow_jump(parameter, size);
-		}
-		free (label);
-	}
-	else {
-		// This is a very bad place
-		add_ret_addr(current_instruction_index + size);
-	}
-	return;
+	if (calls.current > 0)
+		return calls.address[--calls.current];
+	return 0;
 }
 
-void ws_flow_jump(char* parameter, int size)
+void step_through_program(void)
 {
-	char* label_number;
-	int i;
-	if (retrieve_label_or_number(&(parameter[size]), &label_number)) {
-		for (i = 0; i < label_table.total_labels; i++) {
-			if (!strcmp(label_table.label_id[i], label_number)) {
-				current_instruction_index = label_table.label_location[i];
+	struct decoded_instruction* code = program.code;
+	long long left, right;
+	char s[19], * e;
+	int c;
+	current_instruction_index = 0;
+	while (current_instruction_index >= 0 && current_instruction_index < program.size) {
+		struct decoded_instruction* instruction = &(code[current_instruction_index++]);
+		switch (instruction->opcode) {
+			case WS_STACK_PUSH:
+				stack_push(instruction->argument);
 				break;
-			}
+			case WS_STACK_DUP:
+				stack_push(stack_peak(0));
+				break;
+			case WS_STACK_COPY:
+				stack_push(stack_peak(instruction->argument));
+				break;
+			case WS_STACK_SWAP:
+				left = stack_pop();
+				right = stack_pop();
+				stack_push(left);
+				stack_push(right);
+				break;
+			case WS_STACK_DISCARD:
+				stack_pop();
+				break;
+			case WS_STACK_SLIDE:
+				left = stack_pop();
+				for (right = instruction->argument; right > 0; right--)
+					stack_pop();
+				stack_push(left);
+				break;
+			case WS_MATH_ADD:
+				right = stack_pop();
+				left = stack_pop();
+				stack_push(left + right);
+				break;
+			case WS_MATH_SUB:
+				right = stack_pop();
+				left = stack_pop();
+				stack_push(left - right);
+				break;
+			case WS_MATH_MULT:
+				right = stack_pop();
+				left = stack_pop();
+				stack_push(left * right);
+				break;
+			case WS_MATH_DIV:
+				right = stack_pop();
+				left = stack_pop();
+				stack_push(left / right);
+				break;
+			case WS_MATH_MOD:
+				right = stack_pop();
+				left = stack_pop();
+				stack_push(left % right);
+				break;
+			case WS_HEAP_STORE:
+				right = stack_pop();
+				left = stack_pop();
+				heap_put(right, left);
+				break;
+			case WS_HEAP_RETRIEVE:
+				stack_push(heap_get(stack_pop()));
+				break;
+			case WS_FLOW_MARK:
+				break;
+			case WS_FLOW_CALL:
+				if (!add_ret_addr(current_instruction_index))
+					break; // This is a very bad place
+				// fall through
+			case WS_FLOW_JUMP:
+				if (instruction->argument == UNRESOLVED_LABEL) {
+					fprintf(stderr, "Jump to a label that does not exist\n");
+					return;
+				}
+				current_instruction_index = instruction->argument;
+				break;
+			case WS_FLOW_JZ:
+				if (stack_pop() == 0LL) {
+					if (instruction->argument == UNRESOLVED_LABEL) {
+						fprintf(stderr, "Jump to a label that does not exist\n");
+						return;
+					}
+					current_instruction_index = instruction->argument;
+				}
+				break;
+			case WS_FLOW_JN:
+				if (stack_pop() < 0LL) {
+					if (instruction->argument == UNRESOLVED_LABEL) {
+						fprintf(stderr, "Jump to a label that does not exist\n");
+						return;
+					}
+					current_instruction_index = instruction->argument;
+				}
+				break;
+			case WS_FLOW_RET:
+				current_instruction_index = get_last_ret_addr();
+				break;
+			case WS_FLOW_EXIT:
+				return;
+			case WS_IO_OUTC:
+				putchar((int)stack_pop());
+				break;
+			case WS_IO_OUTN:
+				printf("%lld", stack_pop());
+				fflush(stdout);
+				break;
+			case WS_IO_INC:
+				c = getchar();
+				heap_put((long long)c, stack_pop());
+				break;
+			case WS_IO_INN:
+				scanf("%18s", s);
+				heap_put(strtoll(s, &e, 10), stack_pop());
+				break;
+			default:
+				// Not an instruction, wait for a key like it always did
+				getchar();
 		}
-		free (label_number);
-	}
-	else {
-		// This would be very bad
-		current_instruction_index += size;
 	}
 	return;
 }
 
-void ws_flow_jz(char* parameter, int size)
+// [SPACE] = bin(0), [TAB] = bin(1)
+// First 'space' represents signage, [SPACE] = positive, [TAB] = negative
+long long convert_ws_to_number(char* ws)
 {
-	int leap;
-	char * label;
-	if (stack_pop() == 0LL) {
-		ws_flow_jump(parameter, size);
-	}
-	else {
-		if (leap = retrieve_label_or_number(&(parameter[size]), &label)) {
-			current_instruction_index += size + leap + 1;
-			free (label);
+	long long amt = 0;
+	if (ws) {
+		int len = strlen(ws) - 1;
+		for (int i = 0; len > 0; len--, i++) {
+			if (ws[len] == '\x09' && i < 64) amt += (1LL << i);
 		}
-		else 
-			current_instruction_index += size;
+		if (ws[0] == '\x09') amt = -amt;
 	}
-	return;
+	return amt;
 }
 
-void ws_flow_jn(char* parameter, int size)
+// This function returns how much of data ret used up, which is the label or number and its [LF]
+int retrieve_label_or_number(char* data, char** ret)
 {
-	int leap;
-	char * label;
-	if (stack_pop() < 0LL) {
-		ws_flow_jump(parameter, size);
-	}
-	else {
-		if (leap = retrieve_label_or_number(&(parameter[size]), &label)) {
-			current_instruction_index += size + leap + 1;
-			free (label);
+	char* loc;
+	if (loc = strchr(data, '\x0A')) {
+		if (*ret = (char*)malloc(loc - data + 1)) {
+			memcpy(*ret, data, loc - data);
+			(*ret)[loc - data] = 0;
+			return loc - data + 1;
 		}
-		else 
-			current_instruction_index += size;
 	}
-	return;
-}
-
-void ws_flow_ret(char* parameter, int size)
-{
-	current_instruction_index = get_last_ret_addr();
-	return;
-}
-
-void ws_flow_exit(char* parameter, int size)
-{
-	current_instruction_index = -1;
-	return;
-}
-
-void ws_io_outc(char* parameter, int size)
-{
-	putchar((int)stack_pop());
-	current_instruction_index += size;
-	return;
-}
-
-void ws_io_outn(char* parameter, int size)
-{
-	printf("%lld", stack_pop());
-	fflush(stdout);
-	current_instruction_index += size;
-	return;
-}
-
-void ws_io_inc(char* parameter, int size)
-{
-	int c = getchar();
-	heap_put((long long)c, stack_pop());
-	current_instruction_index += size;
-	return;
-}
-
-void ws_io_inn(char* parameter, int size)
-{
-	char s[19], * e;
-	scanf("%18s", s);
-	heap_put(strtoll(s, &e, 10), stack_pop());
-	current_instruction_index += size;
-	return;
 	
+	return 0;
 }
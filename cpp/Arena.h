@@ -0,0 +1,72 @@
+// bump allocator for the objects of one program
+//
+// Objects are placed one after the other in big chunks, so the ops of a
+// program lie in memory in program order, and the whole arena is freed in
+// one go.  Destructors are never run, so nothing placed in an arena may own
+// memory of its own.
+
+#include <new>
+
+#define ARENA_NEW( arena, T ) new( (arena).alloc( sizeof( T ) ) ) T
+
+class Arena
+{
+	vector< char* > chunks;
+	char* start;	// of the current chunk
+	char* top;
+	char* end;
+	int chunkSize;
+
+public:
+	Arena( int _chunkSize = 64 * 1024 )
+		:start( NULL ),
+		top( NULL ),
+		end( NULL ),
+		chunkSize( _chunkSize )
+	{
+	}
+
+	~Arena()
+	{
+		for( int i = 0; i < chunks.size(); ++ i )
+		{
+			delete [] chunks[i];
+		}
+	}
+
+	void* alloc( int size )
+	{
+		size = ( size + 7 ) & ~7;
+		if( end - top < size )
+		{
+			grow( size );
+		}
+		void* p = top;
+		top += size;
+		return p;
+	}
+
+	char* mark()
+	{
+		return top;
+	}
+
+	// gives back what was allocated since mark, if it is still in reach
+	void release( char* m )
+	{
+		if( m >= start && m <= top )
+		{
+			top = m;
+		}
+	}
+
+protected:
+	void grow( int size )
+	{
+		int n = __max( chunkSize, size );
+		start = new char[n];
+		top = start;
+		end = start + n;
+		chunks.push_back( start );
+	}
+};
@@ -0,0 +1,871 @@
+// assembler for the .wsa sources in whitespace/
+//
+// One op per line, ; and -- start a comment and {- -} comments out a block.
+// Besides the ops of Ops.h, with the names getName() gives them, it knows
+//
+//	op n		push n; op, for the ops without an argument (retrive 29)
+//	store n		push n; swap; store, the value is on top
+//	test n		doub; push n; sub
+//	pushs "s"	push 0 and the characters of s, the first one on top
+//	jumpp l		jumps if the top is > 0, jumppz if >= 0, jumpnz if <= 0,
+//			and pops it like jumpz does
+//	include name	appends name.wsa once, looked up next to the file that
+//			includes it and then in includePaths
+//	ifoption o	the lines up to endoption count only if o is set
+//	heap name n	n cells of heap, from there on name+k is an address in them
+//	export names	the labels a module shares, all it defines if none
+//
+// Numbers may be 'c'.  Ops and labels do not care about case.  Labels are
+// interned in the order they show up and written as their id, so long names
+// cost nothing at run time.  The result is byte code as toByteCode() makes
+// it, toWhitespace() and pack() turn it into the formats for files.
+//
+// With module set a file is assembled on its own: include only names a
+// module the Linker links in, labels that are not defined are imports and
+// heap addresses are relocated later.  toModule() gives what the Linker needs.
+
+// what files that hold byte code start with
+#define PACKED_MAGIC "wsp1"
+#define BYTECODE_MAGIC "wsb1\n"
+
+enum
+{
+	argNone,
+	argNumber,
+	argLabel
+};
+
+struct AssemblerOp
+{
+	const char* name;
+	const char* signature;
+	int arg;
+};
+
+static const AssemblerOp assemblerOps[] =
+{
+	{ "push", SIGNATURE_PUSH, argNumber },
+	{ "pop", SIGNATURE_POP, argNone },
+	{ "label", SIGNATURE_LABEL, argLabel },
+	{ "doub", SIGNATURE_DOUB, argNone },
+	{ "swap", SIGNATURE_SWAP, argNone },
+	{ "add", SIGNATURE_ADD, argNone },
+	{ "sub", SIGNATURE_SUB, argNone },
+	{ "mul", SIGNATURE_MUL, argNone },
+	{ "div", SIGNATURE_DIV, argNone },
+	{ "mod", SIGNATURE_MOD, argNone },
+	{ "store", SIGNATURE_STORE, argNone },
+	{ "retrive", SIGNATURE_RETRIVE, argNone },
+	{ "call", SIGNATURE_CALL, argLabel },
+	{ "jump", SIGNATURE_JUMP, argLabel },
+	{ "jumpz", SIGNATURE_JUMPZ, argLabel },
+	{ "jumpn", SIGNATURE_JUMPN, argLabel },
+	{ "ret", SIGNATURE_RET, argNone },
+	{ "exit", SIGNATURE_EXIT, argNone },
+	{ "outc", SIGNATURE_OUTC, argNone },
+	{ "outn", SIGNATURE_OUTN, argNone },
+	{ "inc", SIGNATURE_INC, argNone },
+	{ "inn", SIGNATURE_INN, argNone },
+	{ "debug_printstack", SIGNATURE_DEBUG_PRINT_STACK, argNone },
+	{ "debug_printheap", SIGNATURE_DEBUG_PRINT_HEAP, argNone }
+};
+
+const int assemblerOpCount = sizeof( assemblerOps ) / sizeof( assemblerOps[0] );
+
+// a file assembled on its own, in the text --asm -f module writes: the
+// labels in code are ids of the module and pushes of heap addresses hold
+// the offset into their region
+class Module
+{
+public:
+	unsigned source;	// fnv-1a of the source it came from
+	string options;	// it was assembled with
+	string code;
+	int labelCount;
+	map< string, int > exports;	// name, id
+	map< string, int > imports;
+	vector< string > heapNames;
+	vector< int > heapSizes;
+	vector< pair< int, int > > relocations;	// op index of a push, region
+	vector< string > required;	// names of includes
+
+	Module()
+		:source( 0 ),
+		labelCount( 0 )
+	{
+	}
+
+	string write()
+	{
+		ostringstream out;
+		out << "wso1" << endl;
+		out << "source " << source << endl;
+		out << "options " << options << endl;
+		out << "labels " << labelCount << endl;
+		map< string, int >::iterator it;
+		for( it = exports.begin(); it != exports.end(); ++ it )
+		{
+			out << "export " << it->first << " " << it->second << endl;
+		}
+		for( it = imports.begin(); it != imports.end(); ++ it )
+		{
+			out << "import " << it->first << " " << it->second << endl;
+		}
+		for( int i = 0; i < heapNames.size(); ++ i )
+		{
+			out << "heap " << heapNames[i] << " " << heapSizes[i] << endl;
+		}
+		for( int i2 = 0; i2 < relocations.size(); ++ i2 )
+		{
+			out << "relocate " << relocations[i2].first << " " << relocations[i2].second << endl;
+		}
+		for( int i3 = 0; i3 < required.size(); ++ i3 )
+		{
+			out << "require " << required[i3] << endl;
+		}
+		out << "code " << code << endl;
+		return out.str();
+	}
+
+	bool read( const string& data )
+	{
+		istringstream in( data );
+		string line;
+		if( !getline( in, line ) || line != "wso1" )
+		{
+			return false;
+		}
+		while( getline( in, line ) )
+		{
+			istringstream fields( line );
+			string what;
+			string name;
+			int a = 0;
+			int b = 0;
+			fields >> what;
+			if( what == "source" )
+			{
+				fields >> source;
+			}
+			else if( what == "options" )
+			{
+				fields >> options;
+			}
+			else if( what == "labels" )
+			{
+				fields >> labelCount;
+			}
+			else if( what == "export" && fields >> name >> a )
+			{
+				exports[name] = a;
+			}
+			else if( what == "import" && fields >> name >> a )
+			{
+				imports[name] = a;
+			}
+			else if( what == "heap" && fields >> name >> a )
+			{
+				heapNames.push_back( name );
+				heapSizes.push_back( a );
+			}
+			else if( what == "relocate" && fields >> a >> b )
+			{
+				relocations.push_back( make_pair( a, b ) );
+			}
+			else if( what == "require" && fields >> name )
+			{
+				required.push_back( name );
+			}
+			else if( what == "code" )
+			{
+				fields >> code;
+				return true;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return false;
+	}
+};
+
+class Assembler
+{
+public:
+	vector< string > includePaths;
+	map< string, bool > options;	// the ones that are set
+	bool module;
+	int heapBase;	// of the first heap region, if not a module
+	string code;	// byte code, a for space, b for tab and c for line feed
+	vector< string > errors;	// file:line: what
+	int ops;	// written, macros count as the ops they turn into
+
+protected:
+	LabelTable labels;
+	vector< int > defined;	// line of the label of every id, 0 if none
+	vector< string > usedAt;	// where every id was first used
+	int macroLabels;
+	vector< string > exports;	// names
+	map< string, int > heapRegions;	// name, index
+	vector< string > heapNames;
+	vector< int > heapSizes;
+	vector< int > heapBases;
+	int heapUsed;
+	vector< pair< int, int > > relocations;
+	vector< string > required;
+	unsigned sourceHash;
+	map< string, bool > included;	// paths
+	vector< string > queue;	// of includes that are still to be read
+	string file;	// being read
+	int line;
+
+public:
+	Assembler()
+		:module( false ),
+		heapBase( 0 ),
+		ops( 0 ),
+		macroLabels( 0 ),
+		heapUsed( 0 ),
+		sourceHash( 2166136261u ),
+		line( 0 )
+	{
+	}
+
+	// reads path and everything it includes, true if there were no errors
+	bool assembleFile( const string& path )
+	{
+		included[path] = true;
+		queue.push_back( path );
+		return assembleQueue( path, 0 );
+	}
+
+	// source is what path holds, its includes are still read from files
+	bool assembleSource( const string& source, const string& path )
+	{
+		included[path] = true;
+		queue.push_back( path );
+		sourceHash = hashOf( source, sourceHash );
+		assemble( source, path );
+		return assembleQueue( path, 1 );
+	}
+
+	// the files that were read for the includes, after assembling
+	void includedFiles( vector< string >& files )
+	{
+		files.assign( queue.begin() + __min( 1, (int) queue.size() ), queue.end() );
+	}
+
+	void toModule( Module& m )
+	{
+		m.source = sourceHash;
+		m.options = optionList( options );
+		m.code = code;
+		m.labelCount = labels.size();
+		for( int id = 0; id < labels.size(); ++ id )
+		{
+			string& name = labels.names[id];
+			if( id >= defined.size() || !defined[id] )
+			{
+				m.imports[name] = id;
+			}
+			else if( exports.empty() ? name[0] != '\1' : find( exports.begin(), exports.end(), name ) != exports.end() )
+			{
+				m.exports[name] = id;
+			}
+		}
+		m.heapNames = heapNames;
+		m.heapSizes = heapSizes;
+		m.relocations = relocations;
+		m.required = required;
+	}
+
+	static string optionList( map< string, bool >& set )
+	{
+		string list;
+		map< string, bool >::iterator it;
+		for( it = set.begin(); it != set.end(); ++ it )
+		{
+			list += ( list.length() ? "," : "" ) + it->first;
+		}
+		return list;
+	}
+
+	static unsigned hashOf( const string& data, unsigned h = 2166136261u )
+	{
+		for( int i = 0; i < data.length(); ++ i )
+		{
+			h = ( h ^ (unsigned char) data[i] ) * 16777619u;
+		}
+		return h;
+	}
+
+	// name.ext or name, next to the file from and then in paths, empty if
+	// there is none
+	static string findFile( const string& name, const char* ext, const string& from, vector< string >& paths )
+	{
+		string dir;
+		int slash = from.find_last_of( "/\\" );
+		if( slash >= 0 )
+		{
+			dir = from.substr( 0, slash + 1 );
+		}
+
+		vector< string > tries;
+		tries.push_back( dir + name + ext );
+		tries.push_back( dir + name );
+		for( int i = 0; i < paths.size(); ++ i )
+		{
+			tries.push_back( paths[i] + "/" + name + ext );
+			tries.push_back( paths[i] + "/" + name );
+		}
+
+		for( int i2 = 0; i2 < tries.size(); ++ i2 )
+		{
+			ifstream probe( tries[i2].c_str() );
+			if( probe )
+			{
+				return tries[i2];
+			}
+		}
+		return string();
+	}
+
+	// sign, bits, c like OpPush reads it
+	static void encodeNumber( string& out, int v )
+	{
+		out += ( v < 0 ) ? 'b' : 'a';
+		encodeBits( out, ( v < 0 ) ? 0u - (unsigned) v : (unsigned) v );
+	}
+
+	// a for the sign bit like in the assembler the sources came from
+	static void encodeLabel( string& out, int id )
+	{
+		out += 'a';
+		encodeBits( out, id );
+	}
+
+	static void encodeBits( string& out, unsigned u )
+	{
+		char digits[32];
+		int n = 0;
+		do
+		{
+			digits[n ++] = ( u & 1 ) ? 'b' : 'a';
+			u >>= 1;
+		}
+		while( u );
+		while( n )
+		{
+			out += digits[-- n];
+		}
+		out += 'c';
+	}
+
+	static bool readFile( const string& path, string& data )
+	{
+		ifstream in( path.c_str(), ios::in | ios::binary );
+		if( !in )
+		{
+			return false;
+		}
+		ostringstream all;
+		all << in.rdbuf();
+		data = all.str();
+		return true;
+	}
+
+	static string toWhitespace( const string& byteCode )
+	{
+		string ws( byteCode );
+		for( int i = 0; i < ws.length(); ++ i )
+		{
+			ws[i] = ( ws[i] == 'a' ) ? ' ' : ( ws[i] == 'b' ) ? '\t' : '\n';
+		}
+		return ws;
+	}
+
+	// the magic and four symbols to the byte, two bits each: a 0, b 1, c 2
+	// and 3 for the padding at the end
+	static string pack( const string& byteCode )
+	{
+		string packed( PACKED_MAGIC );
+		int bits = 0;
+		int n = 0;
+		for( int i = 0; i < byteCode.length(); ++ i )
+		{
+			bits |= ( byteCode[i] - 'a' ) << ( 2 * n );
+			if( ++ n == 4 )
+			{
+				packed += (char) bits;
+				bits = 0;
+				n = 0;
+			}
+		}
+		if( n )
+		{
+			for( ; n < 4; ++ n )
+			{
+				bits |= 3 << ( 2 * n );
+			}
+			packed += (char) bits;
+		}
+		return packed;
+	}
+
+	static bool isPacked( const string& data )
+	{
+		return data.compare( 0, strlen( PACKED_MAGIC ), PACKED_MAGIC ) == 0;
+	}
+
+	static string unpack( const string& packed )
+	{
+		string byteCode;
+		byteCode.reserve( 4 * packed.length() );
+		for( int i = strlen( PACKED_MAGIC ); i < packed.length(); ++ i )
+		{
+			int bits = (unsigned char) packed[i];
+			for( int k = 0; k < 4; ++ k, bits >>= 2 )
+			{
+				if( ( bits & 3 ) == 3 )
+				{
+					break;
+				}
+				byteCode += (char) ( 'a' + ( bits & 3 ) );
+			}
+		}
+		return byteCode;
+	}
+
+protected:
+	// assembles the files in queue from first on, then checks the labels of all
+	bool assembleQueue( const string& path, int first )
+	{
+		for( int i = first; i < queue.size(); ++ i )
+		{
+			string source;
+			if( !readFile( queue[i], source ) )
+			{
+				errors.push_back( queue[i] + ": can not read" );
+				continue;
+			}
+			sourceHash = hashOf( source, sourceHash );
+			assemble( source, queue[i] );
+		}
+
+		for( int id = 0; id < defined.size(); ++ id )
+		{
+			if( !defined[id] && usedAt[id].length() && !module )
+			{
+				errors.push_back( usedAt[id] + ": label " + labels.names[id] + " is nowhere" );
+			}
+		}
+		for( int i2 = 0; i2 < exports.size(); ++ i2 )
+		{
+			int id = labels.intern( exports[i2].data(), exports[i2].length() );
+			if( id >= defined.size() || !defined[id] )
+			{
+				errors.push_back( path + ": label " + exports[i2] + " is exported but nowhere" );
+			}
+		}
+		return errors.empty();
+	}
+
+	void assemble( const string& source, const string& name )
+	{
+		file = name;
+		line = 0;
+		int skipping = 0;	// depth of ifoptions that are not set
+		int depth = 0;	// of {- -}
+		int at = 0;
+		while( at < source.length() )
+		{
+			int end = source.find( '\n', at );
+			if( end < 0 )
+			{
+				end = source.length();
+			}
+			++ line;
+
+			vector< string > tokens;
+			split( source.substr( at, end - at ), depth, tokens );
+			at = end + 1;
+			if( tokens.empty() )
+			{
+				continue;
+			}
+
+			string& op = tokens[0];
+			op = lower( op );
+			if( op == "ifoption" || op == "endoption" )
+			{
+				if( op == "endoption" )
+				{
+					skipping -= ( skipping > 0 );
+				}
+				else if( skipping || tokens.size() < 2 || options.find( tokens[1] ) == options.end() )
+				{
+					++ skipping;
+				}
+				continue;
+			}
+			if( skipping )
+			{
+				continue;
+			}
+			statement( tokens );
+		}
+	}
+
+	// the words of a line, "..." and '...' stay one word with their quotes
+	void split( const string& text, int& depth, vector< string >& tokens )
+	{
+		string word;
+		for( int i = 0; i < text.length(); ++ i )
+		{
+			char ch = text[i];
+			if( depth )
+			{
+				if( ch == '{' && i + 1 < text.length() && text[i + 1] == '-' )
+				{
+					++ depth;
+					++ i;
+				}
+				else if( ch == '-' && i + 1 < text.length() && text[i + 1] == '}' )
+				{
+					-- depth;
+					++ i;
+				}
+				continue;
+			}
+			if( ch == '{' && i + 1 < text.length() && text[i + 1] == '-' )
+			{
+				++ depth;
+				++ i;
+			}
+			else if( ch == ';' || ( ch == '-' && i + 1 < text.length() && text[i + 1] == '-' ) )
+			{
+				break;
+			}
+			else if( ch == '"' || ch == '\'' )
+			{
+				int close = text.find( ch, i + 1 );
+				if( close < 0 )
+				{
+					close = text.length() - 1;
+				}
+				word += text.substr( i, close - i + 1 );
+				i = close;
+				continue;
+			}
+			else if( !isspace( (unsigned char) ch ) )
+			{
+				word += ch;
+				continue;
+			}
+			if( word.length() )
+			{
+				tokens.push_back( word );
+				word.erase();
+			}
+		}
+		if( word.length() )
+		{
+			tokens.push_back( word );
+		}
+	}
+
+	void statement( vector< string >& tokens )
+	{
+		string& op = tokens[0];
+		string arg = ( tokens.size() > 1 ) ? tokens[1] : string();
+		if( op == "heap" )
+		{
+			heap( tokens );
+			return;
+		}
+		if( op == "export" )
+		{
+			for( int i = 1; i < tokens.size(); ++ i )
+			{
+				exports.push_back( lower( tokens[i] ) );
+			}
+			return;
+		}
+		if( tokens.size() > 2 )
+		{
+			error( "more than one argument" );
+			return;
+		}
+
+		for( int i = 0; i < assemblerOpCount; ++ i )
+		{
+			const AssemblerOp& table = assemblerOps[i];
+			if( op != table.name )
+			{
+				continue;
+			}
+			if( table.arg == argNone && arg.length() )
+			{
+				// add 1, retrive 29, and store 3 for the value on top
+				emit( SIGNATURE_PUSH );
+				number( arg );
+				if( op == "store" )
+				{
+					emit( SIGNATURE_SWAP );
+				}
+				emit( table.signature );
+				return;
+			}
+			if( table.arg != argNone && arg.empty() )
+			{
+				error( op + " needs an argument" );
+				return;
+			}
+			emit( table.signature );
+			if( table.arg == argNumber )
+			{
+				number( arg );
+			}
+			else if( table.arg == argLabel )
+			{
+				label( arg, op == "label" );
+			}
+			return;
+		}
+
+		if( op == "include" && arg.length() )
+		{
+			include( arg );
+		}
+		else if( op == "test" && arg.length() )
+		{
+			emit( SIGNATURE_DOUB );
+			emit( SIGNATURE_PUSH );
+			number( arg );
+			emit( SIGNATURE_SUB );
+		}
+		else if( op == "pushs" && arg.length() >= 2 && arg[0] == '"' )
+		{
+			string s = arg.substr( 1, arg.length() - 2 );
+			emit( SIGNATURE_PUSH );
+			encodeNumber( code, 0 );
+			for( int i2 = s.length() - 1; i2 >= 0; -- i2 )
+			{
+				emit( SIGNATURE_PUSH );
+				encodeNumber( code, (unsigned char) s[i2] );
+			}
+		}
+		else if( ( op == "jumpp" || op == "jumppz" || op == "jumpnz" ) && arg.length() )
+		{
+			jumpIf( op, arg );
+		}
+		else
+		{
+			error( "unknown op " + op );
+		}
+	}
+
+	// the jumps Ops.h does not have, made of jumpn and jumpz
+	void jumpIf( const string& op, const string& target )
+	{
+		string other = macroLabel();
+		if( op == "jumppz" )
+		{
+			// jumpn other; jump target; label other
+			emitLabelled( SIGNATURE_JUMPN, other, false );
+			emitLabelled( SIGNATURE_JUMP, target, false );
+			emitLabelled( SIGNATURE_LABEL, other, true );
+			return;
+		}
+
+		// doub; jumpn no; doub; jumpz no; then what differs
+		emit( SIGNATURE_DOUB );
+		emitLabelled( SIGNATURE_JUMPN, other, false );
+		emit( SIGNATURE_DOUB );
+		emitLabelled( SIGNATURE_JUMPZ, other, false );
+		if( op == "jumpp" )
+		{
+			// pop; jump target; label no; pop
+			emit( SIGNATURE_POP );
+			emitLabelled( SIGNATURE_JUMP, target, false );
+			emitLabelled( SIGNATURE_LABEL, other, true );
+			emit( SIGNATURE_POP );
+		}
+		else
+		{
+			// jump yes; label no; pop; jump target; label yes; pop
+			string yes = macroLabel();
+			emitLabelled( SIGNATURE_JUMP, yes, false );
+			emitLabelled( SIGNATURE_LABEL, other, true );
+			emit( SIGNATURE_POP );
+			emitLabelled( SIGNATURE_JUMP, target, false );
+			emitLabelled( SIGNATURE_LABEL, yes, true );
+			emit( SIGNATURE_POP );
+		}
+	}
+
+	void include( const string& name )
+	{
+		if( module )
+		{
+			if( find( required.begin(), required.end(), name ) == required.end() )
+			{
+				required.push_back( name );
+			}
+			return;
+		}
+
+		string path = findFile( name, ".wsa", file, includePaths );
+		if( path.empty() )
+		{
+			error( "can not find include " + name );
+		}
+		else if( !included[path] )
+		{
+			included[path] = true;
+			queue.push_back( path );
+		}
+	}
+
+	// heap name n
+	void heap( vector< string >& tokens )
+	{
+		int size = ( tokens.size() == 3 ) ? atoi( tokens[2].c_str() ) : 0;
+		if( size <= 0 )
+		{
+			error( "heap needs a name and a size" );
+			return;
+		}
+		string name = lower( tokens[1] );
+		if( heapRegions.find( name ) != heapRegions.end() )
+		{
+			error( "heap " + name + " is defined twice" );
+			return;
+		}
+		heapRegions[name] = heapNames.size();
+		heapNames.push_back( name );
+		heapSizes.push_back( size );
+		heapBases.push_back( heapBase + heapUsed );
+		heapUsed += size;
+	}
+
+	// name or name+k of a heap region
+	bool heapAddress( const string& text, int& region, int& offset )
+	{
+		int plus = text.find( '+' );
+		map< string, int >::iterator it = heapRegions.find( lower( text.substr( 0, plus ) ) );
+		if( it == heapRegions.end() )
+		{
+			return false;
+		}
+		region = it->second;
+		offset = ( plus >= 0 ) ? atoi( text.c_str() + plus + 1 ) : 0;
+		return true;
+	}
+
+	void emit( const char* signature )
+	{
+		code += signature;
+		++ ops;
+	}
+
+	void emitLabelled( const char* signature, const string& name, bool definition )
+	{
+		emit( signature );
+		label( name, definition );
+	}
+
+	// right after the push it belongs to
+	void number( const string& text )
+	{
+		int v = 0;
+		int region = 0;
+		if( heapAddress( text, region, v ) )
+		{
+			if( module )
+			{
+				relocations.push_back( make_pair( ops - 1, region ) );
+			}
+			else
+			{
+				v += heapBases[region];
+			}
+		}
+		else if( text.length() >= 3 && text[0] == '\'' && text[text.length() - 1] == '\'' )
+		{
+			v = (unsigned char) text[1];
+			if( text[1] == '\\' && text.length() == 4 )
+			{
+				char escaped = text[2];
+				v = ( escaped == 'n' ) ? '\n' : ( escaped == 't' ) ? '\t' : ( escaped == '0' ) ? 0 : escaped;
+			}
+		}
+		else
+		{
+			char* end = NULL;
+			double d = strtod( text.c_str(), &end );
+			if( *end || text.empty() || d != (int) d )
+			{
+				error( "not a number: " + text );
+			}
+			v = (int) d;
+		}
+		encodeNumber( code, v );
+	}
+
+	void label( const string& text, bool definition )
+	{
+		string name = lower( text );
+		int id = labels.intern( name.data(), name.length() );
+		if( id >= defined.size() )
+		{
+			defined.resize( id + 1, 0 );
+			usedAt.resize( id + 1 );
+		}
+		if( definition )
+		{
+			if( defined[id] )
+			{
+				error( "label " + name + " is defined twice" );
+			}
+			defined[id] = line;
+		}
+		else if( usedAt[id].empty() )
+		{
+			usedAt[id] = where();
+		}
+
+		encodeLabel( code, id );
+	}
+
+	static string lower( const string& text )
+	{
+		string s( text );
+		for( int i = 0; i < s.length(); ++ i )
+		{
+			s[i] = tolower( (unsigned char) s[i] );
+		}
+		return s;
+	}
+
+	// a name no source can use, they have no control characters
+	string macroLabel()
+	{
+		ostringstream name;
+		name << "\1" << macroLabels ++;
+		return name.str();
+	}
+
+	string where()
+	{
+		ostringstream at;
+		at << file << ":" << line;
+		return at.str();
+	}
+
+	void error( const string& what )
+	{
+		errors.push_back( where() + ": " + what );
+	}
+};
@@ -0,0 +1,118 @@
+// control flow graph of Vm::ops
+//
+// A block starts at a label and after every op that changes the flow, so
+// only the first op of a block can be jumped to.  A call goes on to its
+// target and, once that returns, to the op after it; ret has no successors
+// of its own.  A memoized call is a call that may not need its target.
+// Jumps to labels that are nowhere end the program.
+
+class Block
+{
+public:
+	int first;	// op index
+	int last;	// one behind the last op
+	vector< int > next;	// successor blocks
+	bool reachable;
+
+	Block()
+		:first( 0 ),
+		last( 0 ),
+		reachable( false )
+	{
+	}
+};
+
+class Cfg
+{
+public:
+	vector< Block > blocks;
+	vector< int > blockOf;	// of every op
+
+	Cfg( Vm& vm )
+	{
+		build( vm );
+	}
+
+	// true if no op after op can run in the same go
+	static bool endsBlock( Op* op )
+	{
+		switch( op->getCode() )
+		{
+		case opCall:
+		case opCallMemo:
+		case opJump:
+		case opJumpZ:
+		case opJumpN:
+		case opRet:
+		case opExit:
+		case opOther:
+			return true;
+		}
+		return false;
+	}
+
+	static bool fallsThrough( Op* op )
+	{
+		int code = op->getCode();
+		return code != opJump && code != opRet && code != opExit;
+	}
+
+protected:
+	void build( Vm& vm )
+	{
+		int count = vm.ops.size();
+		blockOf.assign( count, -1 );
+		for( int i = 0; i < count; ++ i )
+		{
+			if( i == 0 || vm.ops[i]->isLabel() || endsBlock( vm.ops[i - 1] ) )
+			{
+				Block b;
+				b.first = i;
+				blocks.push_back( b );
+			}
+			blocks.back().last = i + 1;
+			blockOf[i] = blocks.size() - 1;
+		}
+
+		for( int i2 = 0; i2 < blocks.size(); ++ i2 )
+		{
+			Block& b = blocks[i2];
+			Op* op = vm.ops[b.last - 1];
+			int code = op->getCode();
+			if( code == opCall || code == opCallMemo || code == opJump || code == opJumpZ || code == opJumpN )
+			{
+				int target = vm.labels[ ( (OpLabel*) op )->label ];
+				if( target < count )
+				{
+					b.next.push_back( blockOf[target] );
+				}
+			}
+			if( fallsThrough( op ) && b.last < count )
+			{
+				b.next.push_back( i2 + 1 );
+			}
+		}
+
+		// everything that can be reached from the start
+		vector< int > work;
+		if( blocks.size() )
+		{
+			blocks[0].reachable = true;
+			work.push_back( 0 );
+		}
+		while( work.size() )
+		{
+			Block& b = blocks[work.back()];
+			work.pop_back();
+			for( int i3 = 0; i3 < b.next.size(); ++ i3 )
+			{
+				Block& n = blocks[b.next[i3]];
+				if( !n.reachable )
+				{
+					n.reachable = true;
+					work.push_back( b.next[i3] );
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,496 @@
+// runs a program while the C++ compiler compiles, C++17 and up
+//
+//	#include "Constexpr.h"
+//
+//	constexpr ConstexprOutput< 64 > hello = runConstexpr< 64 >( "   \t  \t   \n..." );
+//	static_assert( hello.error == nullptr, "hello world failed" );
+//
+// The program is the white space source itself, other characters in it are
+// comments as usual.  Reading and the arithmetic come from Semantics.h, the
+// very code Ops.h runs, so the output is what wsinter would print.  There is
+// no input at compile time, inc and inn are errors, and the stack, the calls,
+// the heap, the output and the steps have fixed limits that are template
+// arguments.  Whatever goes wrong ends the run with error set, the output up
+// to there is kept.
+
+// std::array can be written in constexpr code since C++17
+#if __cplusplus >= 201703L || ( defined( _MSVC_LANG ) && _MSVC_LANG >= 201703L )
+
+#include <array>
+
+#include "Semantics.h"
+
+template< int MaxOutput >
+struct ConstexprOutput
+{
+	std::array< char, MaxOutput > bytes;
+	int length;
+	const char* error;	// nullptr if the program ended well
+};
+
+template< int Size >
+class ConstexprStack
+{
+	int values[Size];
+	int count;
+
+public:
+	constexpr ConstexprStack()
+		:values(),
+		count( 0 )
+	{
+	}
+
+	constexpr int size() const
+	{
+		return count;
+	}
+
+	constexpr bool full() const
+	{
+		return count == Size;
+	}
+
+	constexpr int& operator[]( int i )
+	{
+		return values[i];
+	}
+
+	constexpr int& back()
+	{
+		return values[count - 1];
+	}
+
+	constexpr void push_back( int v )
+	{
+		values[count ++] = v;
+	}
+
+	constexpr void pop_back()
+	{
+		-- count;
+	}
+};
+
+struct ConstexprOp
+{
+	int code;	// OpCode, opOther for the debug ops
+	int value;	// of a push, op index of the target for flow control
+	int text;	// where the bits of a label start in the byte code
+	int textLength;	// -1 if it has no label
+	bool printsHeap;	// the debug op that is not the stack one
+};
+
+template< int MaxOutput, int StackSize, int CallDepth, int HeapSize, int N >
+class ConstexprVm
+{
+public:
+	ConstexprOutput< MaxOutput > output;
+
+protected:
+	char code[N];	// byte code
+	int codeLength;
+	ConstexprOp ops[N];
+	int count;
+	ConstexprStack< StackSize > stack;
+	ConstexprStack< CallDepth > calls;
+	int heap[HeapSize];
+	int heapSize;	// cells that were stored to, up to the last one
+
+public:
+	constexpr ConstexprVm( const char ( &source )[N] )
+		:output(),
+		code(),
+		codeLength( 0 ),
+		ops(),
+		count( 0 ),
+		stack(),
+		calls(),
+		heap(),
+		heapSize( 0 )
+	{
+		output.length = 0;
+		output.error = nullptr;
+		for( int i = 0; i < N; ++ i )
+		{
+			char ch = source[i];
+			if( ch == ' ' )
+			{
+				code[codeLength ++] = 'a';
+			}
+			else if( ch == '\t' )
+			{
+				code[codeLength ++] = 'b';
+			}
+			else if( ch == '\n' )
+			{
+				code[codeLength ++] = 'c';
+			}
+		}
+		read();
+		if( !output.error )
+		{
+			link();
+		}
+	}
+
+	constexpr void run( long steps )
+	{
+		int ip = 0;
+		while( !output.error && ip < count )
+		{
+			if( steps -- == 0 )
+			{
+				fail( "too many steps" );
+				break;
+			}
+
+			ConstexprOp& op = ops[ip];
+			++ ip;
+			if( stack.size() < pops( op.code ) )
+			{
+				fail( "operand stack underflow" );
+				break;
+			}
+			if( ( op.code == opPush || op.code == opDoub ) && stack.full() )
+			{
+				fail( "operand stack overflow" );
+				break;
+			}
+
+			int size = stack.size();
+			int v = 0;
+			switch( op.code )
+			{
+			case opPush:
+				stack.push_back( op.value );
+				break;
+			case opPop:
+				stack.pop_back();
+				break;
+			case opDoub:
+				v = stack.back();
+				stack.push_back( v );
+				break;
+			case opSwap:
+				v = stack[size - 1];
+				stack[size - 1] = stack[size - 2];
+				stack[size - 2] = v;
+				break;
+			case opAdd:
+				runAdd( stack );
+				break;
+			case opSub:
+				runSub( stack );
+				break;
+			case opMul:
+				runMul( stack );
+				break;
+			case opDiv:
+			case opMod:
+				if( stack.back() == 0 )
+				{
+					fail( "division by zero" );
+					break;
+				}
+				if( op.code == opDiv )
+				{
+					runDiv( stack );
+				}
+				else
+				{
+					runMod( stack );
+				}
+				break;
+			case opStore:
+				v = stack[size - 2];
+				if( v < 0 || v >= HeapSize )
+				{
+					fail( "heap address out of range" );
+					break;
+				}
+				heap[v] = stack[size - 1];
+				heapSize = ( v >= heapSize ) ? v + 1 : heapSize;
+				stack.pop_back();
+				stack.pop_back();
+				break;
+			case opRetrive:
+				v = stack.back();
+				if( v < 0 || v >= heapSize )
+				{
+					fail( "heap address out of range" );
+					break;
+				}
+				stack.back() = heap[v];
+				break;
+			case opCall:
+				if( calls.full() )
+				{
+					fail( "call stack overflow" );
+					break;
+				}
+				calls.push_back( ip );
+				ip = op.value;
+				break;
+			case opJump:
+				ip = op.value;
+				break;
+			case opJumpZ:
+				v = stack.back();
+				stack.pop_back();
+				ip = ( v == 0 ) ? op.value : ip;
+				break;
+			case opJumpN:
+				v = stack.back();
+				stack.pop_back();
+				ip = ( v < 0 ) ? op.value : ip;
+				break;
+			case opRet:
+				if( calls.size() == 0 )
+				{
+					fail( "ret without call" );
+					break;
+				}
+				ip = calls.back();
+				calls.pop_back();
+				break;
+			case opExit:
+				ip = count;
+				break;
+			case opOutC:
+				put( (char) stack.back() );
+				stack.pop_back();
+				break;
+			case opOutN:
+				putNumber( stack.back() );
+				stack.pop_back();
+				break;
+			case opInC:
+			case opInN:
+				fail( "no input at compile time" );
+				break;
+			case opOther:
+				if( op.printsHeap )
+				{
+					putList( "Heap: [", heap, heapSize );
+				}
+				else
+				{
+					int values[StackSize] = {};
+					for( int i = 0; i < size; ++ i )
+					{
+						values[i] = stack[i];
+					}
+					putList( "Stack: [", values, size );
+				}
+				break;
+			}
+		}
+	}
+
+protected:
+	constexpr void fail( const char* why )
+	{
+		if( !output.error )
+		{
+			output.error = why;
+		}
+	}
+
+	static constexpr int pops( int code )
+	{
+		switch( code )
+		{
+		case opPop:
+		case opDoub:
+		case opRetrive:
+		case opJumpZ:
+		case opJumpN:
+		case opOutC:
+		case opOutN:
+		case opInC:
+		case opInN:
+			return 1;
+		case opSwap:
+		case opAdd:
+		case opSub:
+		case opMul:
+		case opDiv:
+		case opMod:
+		case opStore:
+			return 2;
+		}
+		return 0;
+	}
+
+	// the way Vm::buildOps does it, a byte that starts no op is skipped
+	constexpr void read()
+	{
+		const char* signatures[] =
+		{
+			SIGNATURE_PUSH, SIGNATURE_POP, SIGNATURE_LABEL, SIGNATURE_DOUB, SIGNATURE_SWAP,
+			SIGNATURE_ADD, SIGNATURE_SUB, SIGNATURE_MUL, SIGNATURE_DIV, SIGNATURE_MOD,
+			SIGNATURE_STORE, SIGNATURE_RETRIVE, SIGNATURE_CALL, SIGNATURE_JUMP, SIGNATURE_JUMPZ,
+			SIGNATURE_JUMPN, SIGNATURE_RET, SIGNATURE_EXIT, SIGNATURE_OUTC, SIGNATURE_OUTN,
+			SIGNATURE_INC, SIGNATURE_INN, SIGNATURE_DEBUG_PRINT_STACK, SIGNATURE_DEBUG_PRINT_HEAP
+		};
+		const int codes[] =
+		{
+			opPush, opPop, opLabel, opDoub, opSwap,
+			opAdd, opSub, opMul, opDiv, opMod,
+			opStore, opRetrive, opCall, opJump, opJumpZ,
+			opJumpN, opRet, opExit, opOutC, opOutN,
+			opInC, opInN, opOther, opOther
+		};
+
+		int at = 0;
+		while( at < codeLength )
+		{
+			int length = -1;
+			for( int k = 0; k < 24 && length < 0; ++ k )
+			{
+				int sigLength = 0;
+				while( signatures[k][sigLength] && at + sigLength < codeLength &&
+					code[at + sigLength] == signatures[k][sigLength] )
+				{
+					++ sigLength;
+				}
+				if( signatures[k][sigLength] )
+				{
+					continue;
+				}
+
+				ConstexprOp op = { codes[k], 0, 0, -1, k == 23 };
+				int argument = 0;
+				const char* rest = code + at + sigLength;
+				int left = codeLength - at - sigLength;
+				if( codes[k] == opPush )
+				{
+					op.value = parseNumber( rest, left, argument );
+				}
+				else if( codes[k] == opLabel || codes[k] == opCall || codes[k] == opJump ||
+					codes[k] == opJumpZ || codes[k] == opJumpN )
+				{
+					op.text = at + sigLength;
+					op.textLength = parseLabel( rest, left, argument );
+				}
+				if( argument >= 0 )
+				{
+					ops[count ++] = op;
+					length = sigLength + argument;
+				}
+			}
+			at += ( length < 0 ) ? 1 : length;
+		}
+	}
+
+	// like Vm::buildLabels, jumps to labels that are nowhere end the program
+	constexpr void link()
+	{
+		for( int i = 0; i < count; ++ i )
+		{
+			ConstexprOp& op = ops[i];
+			if( op.textLength < 0 )
+			{
+				continue;
+			}
+			if( op.code == opLabel )
+			{
+				for( int j = 0; j < i; ++ j )
+				{
+					if( ops[j].code == opLabel && sameLabel( ops[j], op ) )
+					{
+						fail( "label defined twice" );
+						return;
+					}
+				}
+				continue;
+			}
+			op.value = count;
+			for( int j2 = 0; j2 < count; ++ j2 )
+			{
+				if( ops[j2].code == opLabel && sameLabel( ops[j2], op ) )
+				{
+					op.value = j2;
+					break;
+				}
+			}
+		}
+	}
+
+	constexpr bool sameLabel( const ConstexprOp& a, const ConstexprOp& b ) const
+	{
+		if( a.textLength != b.textLength )
+		{
+			return false;
+		}
+		for( int i = 0; i < a.textLength; ++ i )
+		{
+			if( code[a.text + i] != code[b.text + i] )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constexpr void put( char ch )
+	{
+		if( output.length == MaxOutput )
+		{
+			fail( "output too long" );
+			return;
+		}
+		output.bytes[output.length ++] = ch;
+	}
+
+	// as "%d" prints it
+	constexpr void putNumber( int v )
+	{
+		char digits[12] = {};
+		int n = 0;
+		unsigned u = ( v < 0 ) ? 0u - (unsigned) v : (unsigned) v;
+		do
+		{
+			digits[n ++] = (char) ( '0' + u % 10 );
+			u /= 10;
+		}
+		while( u );
+		if( v < 0 )
+		{
+			put( '-' );
+		}
+		while( n )
+		{
+			put( digits[-- n] );
+		}
+	}
+
+	constexpr void putList( const char* title, const int* values, int n )
+	{
+		for( int i = 0; title[i]; ++ i )
+		{
+			put( title[i] );
+		}
+		for( int i2 = 0; i2 < n; ++ i2 )
+		{
+			if( i2 > 0 )
+			{
+				put( ',' );
+			}
+			putNumber( values[i2] );
+		}
+		put( ']' );
+		put( '\n' );
+	}
+};
+
+template< int MaxOutput, int StackSize = 256, int CallDepth = 64, int HeapSize = 256, int N >
+constexpr ConstexprOutput< MaxOutput > runConstexpr( const char ( &source )[N], long steps = 100000 )
+{
+	ConstexprVm< MaxOutput, StackSize, CallDepth, HeapSize, N > vm( source );
+	vm.run( steps );
+	return vm.output;
+}
+
+#endif
@@ -0,0 +1,235 @@
+// input and output of a running program
+//
+// Ops never touch cin/cout directly, they go through the Io of their Vm.
+// An Io that has no input available returns false, the op then suspends
+// the Vm and resume() retries it later.  An Io whose output is filling up
+// returns false from put/write, the Vm then yields after the op so the
+// output can be drained (backpressure).
+
+class Io
+{
+public:
+	Io()
+	{
+	}
+
+	virtual ~Io()
+	{
+	}
+
+	// ch is -1 at end of input
+	virtual bool getChar( int& ch ) = 0;
+
+	// v is 0 at end of input or if no number could be read
+	virtual bool getNumber( int& v ) = 0;
+
+	virtual bool write( const char* p, int n ) = 0;
+
+	virtual bool putChar( char ch )
+	{
+		return write( &ch, 1 );
+	}
+
+	virtual bool putNumber( int v )
+	{
+		char buffer[16];
+		int n = sprintf( buffer, "%d", v );
+		return write( buffer, n );
+	}
+
+	// runtime errors, they go with the output unless there is a better place
+	virtual void error( const char* p, int n )
+	{
+		write( p, n );
+	}
+
+	virtual void flush()
+	{
+	}
+};
+
+// blocking io on cin/cout, as the interpreter always did
+class StdIo: public Io
+{
+public:
+	virtual bool getChar( int& ch )
+	{
+		char c;
+		if( cin.get( c ) )
+		{
+			ch = c;
+		}
+		else
+		{
+			ch = -1;
+		}
+		return true;
+	}
+
+	virtual bool getNumber( int& v )
+	{
+		v = 0;
+		cin >> v;
+		return true;
+	}
+
+	virtual bool write( const char* p, int n )
+	{
+		cout.write( p, n );
+		return true;
+	}
+
+	virtual bool putChar( char ch )
+	{
+		cout << ch;
+		return true;
+	}
+
+	virtual bool putNumber( int v )
+	{
+		cout << v;
+		return true;
+	}
+
+	virtual void error( const char* p, int n )
+	{
+		cout.flush();
+		cerr.write( p, n );
+	}
+
+	virtual void flush()
+	{
+		cout.flush();
+	}
+};
+
+extern StdIo stdIo;
+
+// non blocking io on memory buffers, filled and drained by a Reactor
+class BufferIo: public Io
+{
+public:
+	string in;
+	int inPos;
+	bool inEof;
+	bool starved;	// the last read found no input
+
+	string out;
+	int outPos;
+	int highWater;	// of the output, and of the input the Reactor reads ahead
+
+	BufferIo()
+		:inPos( 0 ),
+		inEof( false ),
+		starved( false ),
+		outPos( 0 ),
+		highWater( 64 * 1024 )
+	{
+	}
+
+	void reset()
+	{
+		in.erase();
+		inPos = 0;
+		inEof = false;
+		starved = false;
+		out.erase();
+		outPos = 0;
+	}
+
+	void feed( const char* p, int n )
+	{
+		// drop what was consumed before it grows without bound
+		if( inPos > 4096 && inPos * 2 > in.length() )
+		{
+			in.erase( 0, inPos );
+			inPos = 0;
+		}
+		in.append( p, n );
+		starved = false;
+	}
+
+	int pending()
+	{
+		return out.length() - outPos;
+	}
+
+	// input that was fed but not read yet
+	int buffered()
+	{
+		return in.length() - inPos;
+	}
+
+	void consumed( int n )
+	{
+		outPos += n;
+		if( outPos == out.length() )
+		{
+			out.erase();
+			outPos = 0;
+		}
+	}
+
+	virtual bool getChar( int& ch )
+	{
+		starved = false;
+		if( inPos < in.length() )
+		{
+			ch = (unsigned char) in[inPos];
+			++ inPos;
+			return true;
+		}
+		if( inEof )
+		{
+			ch = -1;
+			return true;
+		}
+		starved = true;
+		return false;
+	}
+
+	// parses like cin >> v: skips white space, reads an optional sign and
+	// digits and leaves the character behind them in the buffer
+	virtual bool getNumber( int& v )
+	{
+		starved = false;
+		int i = inPos;
+		while( i < in.length() && isspace( (unsigned char) in[i] ) )
+		{
+			++ i;
+		}
+
+		int start = i;
+		if( i < in.length() && ( in[i] == '-' || in[i] == '+' ) )
+		{
+			++ i;
+		}
+		while( i < in.length() && isdigit( (unsigned char) in[i] ) )
+		{
+			++ i;
+		}
+
+		if( i == in.length() && !inEof )
+		{
+			// the number may go on in the next chunk
+			starved = true;
+			return false;
+		}
+
+		v = atoi( in.substr( start, i - start ).c_str() );
+		inPos = i;
+		return true;
+	}
+
+	virtual bool write( const char* p, int n )
+	{
+		out.append( p, n );
+		return pending() < highWater;
+	}
+
+	virtual bool putChar( char ch )
+	{
+		out += ch;
+		return pending() < highWater;
+	}
+};
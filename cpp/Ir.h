@@ -0,0 +1,635 @@
+// register machine the ops are translated to
+//
+// Every basic block of Vm::ops is translated on its own.  While a block is
+// translated the operand stack is only tracked: pushes and arithmetic make
+// new registers, doub, swap and pop just move registers around, and nothing
+// goes to vm.stack before the end of the block, where whatever the block
+// left on the stack is spilled.  Values the block finds on the stack when it
+// starts are popped into registers when they are first needed.
+//
+// Every register is written once per run of its block.  Constants have
+// registers of their own that are set when the program is translated, so a
+// push costs nothing at run time.
+//
+// Heap cells with a constant address are kept in registers as well: within
+// a block the first retrive of such a cell loads it, later ones reuse the
+// register, and a store only changes which register holds the cell.  Stored
+// cells are written back when the block ends and before any access with a
+// computed address, which could hit the same cell, or a load below one of
+// them, which only exists once the store grew the heap.
+//
+// With Vm::checked the arithmetic stops the program instead of wrapping
+// around or trapping, except where RangeAnalysis shows it can not overflow.
+
+enum IrCode
+{
+	irAdd,		// d = a + b
+	irSub,
+	irMul,
+	irDiv,
+	irMod,
+	irAddChecked,	// the same, stop the program if the result is no int
+	irSubChecked,
+	irMulChecked,
+	irDivChecked,
+	irModChecked,
+	irLoad,		// d = heap[a]
+	irStore,	// heap[a] = b
+	irPush,		// push a
+	irPop,		// d = pop
+	irDrop,		// pop
+	irJump,		// to d
+	irJumpZ,	// to d if a == 0
+	irJumpN,	// to d if a < 0
+	irCall,
+	irCallMemo,	// to d unless op has the results, then past the irMemoSave
+	irMemoSave,	// of op, right behind its irCallMemo
+	irRet,
+	irExit,
+	irOutC,		// of a
+	irOutN,
+	irOutS,		// the bytes of op
+	irInC,		// to heap[a]
+	irInN,
+	irCharge,	// gas -= a, a is no register
+	irOp		// runs op on vm.stack
+};
+
+class IrInst
+{
+public:
+	int code;
+	int d;
+	int a;
+	int b;
+	Op* op;		// it came from
+	int origin;	// index of op
+};
+
+class Ir
+{
+public:
+	vector< IrInst > code;
+	vector< int > regs;
+	vector< int > entry;	// ir index of every op that starts a block, -1 for the others
+	int ops;	// how many ops were translated
+	int loadsPromoted;	// retrives and stores that are not done any more
+	int storesPromoted;
+	int arithmeticOps;	// with -c
+	int provenOps;	// of those, the ones that run without checks
+
+protected:
+	map< int, int > constants;	// value -> register
+	vector< int > values;	// of the constant registers
+	vector< int > stack;	// registers on the tracked stack, top last
+	vector< int > pushedBy;	// the op index of every entry of stack
+	vector< bool > isConstant;	// of every register
+	map< int, int > cells;	// heap address -> register holding the cell
+	map< int, int > dirty;	// the cells stored to since the last write back
+	RangeAnalysis* ranges;	// NULL checks nothing
+	Op* originOp;
+	int origin;
+
+public:
+	Ir( Vm& vm )
+		:ops( 0 ),
+		loadsPromoted( 0 ),
+		storesPromoted( 0 ),
+		arithmeticOps( 0 ),
+		provenOps( 0 ),
+		ranges( NULL )
+	{
+		translate( vm );
+	}
+
+	// index of the op the instruction before ip came from, plus one
+	int opIp( int ip )
+	{
+		if( ip > 0 && ip <= code.size() )
+		{
+			return code[ip - 1].origin + 1;
+		}
+		return ip;
+	}
+
+protected:
+	void translate( Vm& vm )
+	{
+		int count = vm.ops.size();
+		ops = count;
+
+		RangeAnalysis* analysis = NULL;
+		if( vm.checked )
+		{
+			analysis = new RangeAnalysis( vm );
+			arithmeticOps = analysis->arithmeticOps;
+			provenOps = analysis->provenOps;
+		}
+		ranges = analysis;
+
+		Cfg cfg( vm );
+		vector< bool > leader( count + 1, false );
+		for( int i = 0; i < cfg.blocks.size(); ++ i )
+		{
+			leader[ cfg.blocks[i].first ] = true;
+		}
+
+		entry.assign( count + 1, -1 );
+		for( int i2 = 0; i2 < count; ++ i2 )
+		{
+			if( leader[i2] )
+			{
+				spill();
+				entry[i2] = code.size();
+			}
+			origin = i2;
+			originOp = vm.ops[i2];
+			translate( vm, vm.ops[i2] );
+		}
+		spill();
+		entry[count] = code.size();
+		ranges = NULL;
+		delete analysis;
+
+		// the targets were op indices so far
+		for( int i3 = 0; i3 < code.size(); ++ i3 )
+		{
+			IrInst& inst = code[i3];
+			if( inst.code == irJump || inst.code == irJumpZ ||
+				inst.code == irJumpN || inst.code == irCall || inst.code == irCallMemo )
+			{
+				inst.d = entry[inst.d];
+			}
+		}
+
+		regs.resize( values.size() );
+		for( int i4 = 0; i4 < values.size(); ++ i4 )
+		{
+			regs[i4] = values[i4];
+		}
+	}
+
+	void translate( Vm& vm, Op* op )
+	{
+		int a, b;
+		switch( op->getCode() )
+		{
+		case opPush:
+			track( constant( ( (OpPush*) op )->value ) );
+			break;
+		case opPop:
+			if( stack.size() )
+			{
+				pop();
+			}
+			else
+			{
+				emit( irDrop );
+			}
+			break;
+		case opLabel:
+			break;
+		case opDoub:
+			need( 1 );
+			track( stack.back() );
+			break;
+		case opSwap:
+			need( 2 );
+			swap( stack[stack.size() - 2], stack[stack.size() - 1] );
+			swap( pushedBy[stack.size() - 2], pushedBy[stack.size() - 1] );
+			break;
+		case opAdd:
+			arithmetic( irAdd );
+			break;
+		case opSub:
+			arithmetic( irSub );
+			break;
+		case opMul:
+			arithmetic( irMul );
+			break;
+		case opDiv:
+			arithmetic( irDiv );
+			break;
+		case opMod:
+			arithmetic( irMod );
+			break;
+		case opStore:
+			b = pop();
+			a = pop();
+			if( isConstant[a] && values[a] >= 0 && values[a] < vm.heapLimit )
+			{
+				cells[ values[a] ] = b;
+				dirty[ values[a] ] = b;
+				++ storesPromoted;
+			}
+			else
+			{
+				writeBack();
+				cells.clear();
+				emit( irStore, -1, a, b );
+			}
+			break;
+		case opRetrive:
+			a = pop();
+			if( isConstant[a] )
+			{
+				map< int, int >::iterator it = cells.find( values[a] );
+				if( it != cells.end() )
+				{
+					track( it->second );
+					++ loadsPromoted;
+				}
+				else
+				{
+					// a held store may be the one that grows the heap over
+					// this cell
+					if( dirty.size() && dirty.rbegin()->first >= values[a] )
+					{
+						writeBack();
+					}
+					track( cells[ values[a] ] = emit( irLoad, reg(), a ) );
+				}
+			}
+			else
+			{
+				writeBack();
+				track( emit( irLoad, reg(), a ) );
+			}
+			break;
+		case opCall:
+			spill();
+			emit( irCall, target( vm, op ) );
+			break;
+		case opCallMemo:
+			spill();
+			emit( irCallMemo, target( vm, op ) );
+			break;
+		case opMemoSave:
+			emit( irMemoSave );
+			break;
+		case opJump:
+			spill();
+			emit( irJump, target( vm, op ) );
+			break;
+		case opJumpZ:
+			a = pop();
+			spill();
+			emit( irJumpZ, target( vm, op ), a );
+			break;
+		case opJumpN:
+			a = pop();
+			spill();
+			emit( irJumpN, target( vm, op ), a );
+			break;
+		case opRet:
+			spill();
+			emit( irRet );
+			break;
+		case opExit:
+			spill();
+			emit( irExit );
+			break;
+		case opOutC:
+			emit( irOutC, -1, pop() );
+			break;
+		case opOutN:
+			emit( irOutN, -1, pop() );
+			break;
+		case opOutS:
+			emit( irOutS );
+			break;
+		case opInC:
+			a = pop();
+			writeBack();
+			cells.clear();
+			emit( irInC, -1, a );
+			break;
+		case opInN:
+			a = pop();
+			writeBack();
+			cells.clear();
+			emit( irInN, -1, a );
+			break;
+		case opCharge:
+			emit( irCharge, -1, ( (OpCharge*) op )->cost );
+			break;
+		default:
+			spill();
+			emit( irOp );
+			break;
+		}
+	}
+
+	int target( Vm& vm, Op* op )
+	{
+		return vm.labels[ ( (OpLabel*) op )->label ];
+	}
+
+	void arithmetic( int c )
+	{
+		if( ranges && !ranges->safe[origin] )
+		{
+			c += irAddChecked - irAdd;
+		}
+		int b = pop();
+		int a = pop();
+		track( emit( c, reg(), a, b ) );
+	}
+
+	// returns d
+	int emit( int c, int d = -1, int a = -1, int b = -1 )
+	{
+		IrInst inst;
+		inst.code = c;
+		inst.d = d;
+		inst.a = a;
+		inst.b = b;
+		inst.op = originOp;
+		inst.origin = origin;
+		code.push_back( inst );
+		return d;
+	}
+
+	int reg()
+	{
+		values.push_back( 0 );
+		isConstant.push_back( false );
+		return values.size() - 1;
+	}
+
+	int constant( int v )
+	{
+		map< int, int >::iterator it = constants.find( v );
+		if( it != constants.end() )
+		{
+			return it->second;
+		}
+		int r = reg();
+		values[r] = v;
+		isConstant[r] = true;
+		constants[v] = r;
+		return r;
+	}
+
+	void track( int r )
+	{
+		stack.push_back( r );
+		pushedBy.push_back( origin );
+	}
+
+	// makes sure n values are tracked, the missing ones come from vm.stack
+	void need( int n )
+	{
+		while( stack.size() < n )
+		{
+			stack.insert( stack.begin(), emit( irPop, reg() ) );
+			pushedBy.insert( pushedBy.begin(), origin );
+		}
+	}
+
+	int pop()
+	{
+		need( 1 );
+		int r = stack.back();
+		stack.pop_back();
+		pushedBy.pop_back();
+		return r;
+	}
+
+	// leaves the stack and the heap the way the ops would have left them,
+	// before flow control and ops that are not translated
+	void spill()
+	{
+		// a push that overflows is the op that pushed the value, like on
+		// the ops
+		for( int i = 0; i < stack.size(); ++ i )
+		{
+			emit( irPush, -1, stack[i] );
+			code.back().origin = pushedBy[i];
+		}
+		stack.clear();
+		pushedBy.clear();
+		writeBack();
+		cells.clear();
+	}
+
+	void writeBack()
+	{
+		storesPromoted -= dirty.size();
+		map< int, int >::iterator it;
+		for( it = dirty.begin(); it != dirty.end(); ++ it )
+		{
+			emit( irStore, -1, constant( it->first ), it->second );
+		}
+		dirty.clear();
+	}
+};
+
+void Vm::buildIr()
+{
+	delete ir;
+	ir = new Ir( *this );
+}
+
+int Vm::opIp()
+{
+	return ir ? ir->opIp( ip ) : ip;
+}
+
+void Vm::loopIr( int slice )
+{
+	int size = ir->code.size();
+	IrInst* code = size ? &ir->code[0] : NULL;
+	int* r = ir->regs.size() ? &ir->regs[0] : NULL;
+	int ch;
+
+	while( running )
+	{
+		if( ip >= size )
+		{
+			running = false;
+		}
+		else if( slice >= 0 && slice-- == 0 )
+		{
+			suspend( false );
+		}
+		else
+		{
+			IrInst& i = code[ip];
+			++ ip;
+			switch( i.code )
+			{
+			case irAdd:
+				r[i.d] = wrapAdd( r[i.a], r[i.b] );
+				break;
+			case irSub:
+				r[i.d] = wrapSub( r[i.a], r[i.b] );
+				break;
+			case irMul:
+				r[i.d] = wrapMul( r[i.a], r[i.b] );
+				break;
+			case irDiv:
+			case irMod:
+				if( r[i.b] == 0 )
+				{
+					stop( "division by zero" );
+					break;
+				}
+				r[i.d] = ( i.code == irDiv ) ? wrapDiv( r[i.a], r[i.b] ) : wrapMod( r[i.a], r[i.b] );
+				break;
+			case irAddChecked:
+				if( ( r[i.b] > 0 && r[i.a] > INT_MAX - r[i.b] ) ||
+					( r[i.b] < 0 && r[i.a] < INT_MIN - r[i.b] ) )
+				{
+					stop( "arithmetic overflow" );
+					break;
+				}
+				r[i.d] = r[i.a] + r[i.b];
+				break;
+			case irSubChecked:
+				if( ( r[i.b] < 0 && r[i.a] > INT_MAX + r[i.b] ) ||
+					( r[i.b] > 0 && r[i.a] < INT_MIN + r[i.b] ) )
+				{
+					stop( "arithmetic overflow" );
+					break;
+				}
+				r[i.d] = r[i.a] - r[i.b];
+				break;
+			case irMulChecked:
+				{
+					double p = (double) r[i.a] * r[i.b];
+					if( p > INT_MAX || p < INT_MIN )
+					{
+						stop( "arithmetic overflow" );
+						break;
+					}
+					r[i.d] = r[i.a] * r[i.b];
+				}
+				break;
+			case irDivChecked:
+			case irModChecked:
+				if( r[i.b] == 0 )
+				{
+					stop( "division by zero" );
+					break;
+				}
+				if( r[i.a] == INT_MIN && r[i.b] == -1 )
+				{
+					stop( "arithmetic overflow" );
+					break;
+				}
+				r[i.d] = ( i.code == irDivChecked ) ? r[i.a] / r[i.b] : r[i.a] % r[i.b];
+				break;
+			case irLoad:
+				if( (unsigned) r[i.a] >= heap.size() )
+				{
+					stop( "heap address out of range" );
+					break;
+				}
+				r[i.d] = heap[ r[i.a] ];
+				break;
+			case irStore:
+				i.op->putInHeap( *this, r[i.a], r[i.b] );
+				break;
+			case irPush:
+				stack.push_back( r[i.a] );
+				break;
+			case irPop:
+				r[i.d] = stack.back();
+				stack.pop_back();
+				break;
+			case irDrop:
+				stack.pop_back();
+				break;
+			case irJump:
+				ip = i.d;
+				break;
+			case irJumpZ:
+				if( r[i.a] == 0 )
+				{
+					ip = i.d;
+				}
+				break;
+			case irJumpN:
+				if( r[i.a] < 0 )
+				{
+					ip = i.d;
+				}
+				break;
+			case irCall:
+				calls.push_back( ip );
+				ip = i.d;
+				break;
+			case irCallMemo:
+				if( ( (OpCallMemo*) i.op )->memo->lookUp( *this ) )
+				{
+					++ ip;
+					break;
+				}
+				calls.push_back( ip );
+				ip = i.d;
+				break;
+			case irMemoSave:
+				( (OpMemoSave*) i.op )->memo->save( *this );
+				break;
+			case irRet:
+				ip = calls.back();
+				calls.pop_back();
+				break;
+			case irExit:
+				running = false;
+				break;
+			case irOutC:
+				if( !io->putChar( (char) r[i.a] ) )
+				{
+					suspend( false );
+				}
+				break;
+			case irOutN:
+				if( !io->putNumber( r[i.a] ) )
+				{
+					suspend( false );
+				}
+				break;
+			case irOutS:
+				if( !io->write( ( (OpOutS*) i.op )->bytes, ( (OpOutS*) i.op )->length ) )
+				{
+					suspend( false );
+				}
+				break;
+			case irInC:
+				if( !io->getChar( ch ) )
+				{
+					suspend( true );
+					break;
+				}
+				i.op->putInHeap( *this, r[i.a], (char) ch );
+				break;
+			case irInN:
+				if( !io->getNumber( ch ) )
+				{
+					suspend( true );
+					break;
+				}
+				i.op->putInHeap( *this, r[i.a], ch );
+				break;
+			case irCharge:
+				gas -= i.a;
+				if( gas < 0 )
+				{
+					refuel();
+				}
+				break;
+			case irOp:
+				i.op->runGeneric( *this );
+				break;
+			}
+		}
+	}
+}
+
+Vm::~Vm()
+{
+	// the arena frees all ops at once
+	delete ir;
+}
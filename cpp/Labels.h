@@ -0,0 +1,76 @@
+// interns label bit strings into dense ids
+//
+// Labels can be any number of bits long, so they are not folded into an int
+// but looked up by their text while the program is read.  After that a label
+// is just its id, and Vm::labels maps ids to op indices.
+
+class LabelTable
+{
+public:
+	vector< string > names;	// by id
+
+protected:
+	vector< int > slots;	// ids, -1 is empty; a power of two, at most half full
+
+public:
+	LabelTable()
+		:slots( 64, -1 )
+	{
+	}
+
+	int size()
+	{
+		return names.size();
+	}
+
+	int intern( const char* s, int n )
+	{
+		int mask = slots.size() - 1;
+		int i = hashOf( s, n ) & mask;
+		while( slots[i] >= 0 )
+		{
+			string& name = names[slots[i]];
+			if( name.length() == n && memcmp( name.data(), s, n ) == 0 )
+			{
+				return slots[i];
+			}
+			i = ( i + 1 ) & mask;
+		}
+
+		int id = names.size();
+		names.push_back( string( s, n ) );
+		slots[i] = id;
+		if( names.size() * 2 > slots.size() )
+		{
+			grow();
+		}
+		return id;
+	}
+
+protected:
+	// fnv-1a
+	static unsigned hashOf( const char* s, int n )
+	{
+		unsigned h = 2166136261u;
+		for( int i = 0; i < n; ++ i )
+		{
+			h = ( h ^ (unsigned char) s[i] ) * 16777619u;
+		}
+		return h;
+	}
+
+	void grow()
+	{
+		slots.assign( slots.size() * 2, -1 );
+		int mask = slots.size() - 1;
+		for( int id = 0; id < names.size(); ++ id )
+		{
+			int i = hashOf( names[id].data(), names[id].length() ) & mask;
+			while( slots[i] >= 0 )
+			{
+				i = ( i + 1 ) & mask;
+			}
+			slots[i] = id;
+		}
+	}
+};
@@ -0,0 +1,300 @@
+// the blocks of Vm::ops in the order they run, with -F and -U
+//
+//	wsinter prog.ws -F prog.wsf	counts how often every block runs, into prog.wsf
+//	wsinter prog.ws -U prog.wsf	lays the blocks out hot first by those counts
+//
+// A Profile is collected and used at the same point, behind the optimizer
+// and the Memoizer, so the blocks are the same ones as long as the program
+// and those options are.  It keeps a hash of the ops there with their
+// arguments, a profile of another program is left alone.
+//
+// The layout starts at block 0 and then at the hottest block that has no
+// place yet, and from each goes on with the successor the hot path takes,
+// so a loop ends up in one piece.  Where a block falls through to one that
+// is somewhere else it gets a jump there, where a jump goes to the block
+// right behind it the jump is dropped.  A branch can not be turned around,
+// so the hot successor of a jumpz that is its target comes next and the cold
+// one behind it is jumped to.  The op behind a call is where the call
+// returns to, it always stays right behind the call.  Blocks that never ran
+// end up behind all others, in the order they had.
+
+#define PROFILE_MAGIC "wsf1"
+
+class Profile
+{
+public:
+	vector< double > counts;	// of every block
+	int ops;	// the program had when it was collected
+	unsigned hash;	// of those ops
+	int moved;	// blocks that are not where they were
+	int jumpsAdded;
+	int jumpsDropped;
+
+protected:
+	vector< OpCount* > counters;
+
+public:
+	Profile()
+		:ops( 0 ),
+		hash( 0 ),
+		moved( 0 ),
+		jumpsAdded( 0 ),
+		jumpsDropped( 0 )
+	{
+	}
+
+	// an OpCount at the start of every block, behind its label or the
+	// OpMemoSave that has to stay right behind its OpCallMemo
+	void collect( Vm& vm )
+	{
+		Cfg cfg( vm );
+		ops = vm.ops.size();
+		hash = hashOf( vm );
+		vector< Op* > out;
+		for( int b = 0; b < cfg.blocks.size(); ++ b )
+		{
+			Block& block = cfg.blocks[b];
+			int i = block.first;
+			if( vm.ops[i]->isLabel() || vm.ops[i]->getCode() == opMemoSave )
+			{
+				out.push_back( vm.ops[i ++] );
+			}
+			counters.push_back( ARENA_NEW( vm.arena, OpCount ) );
+			out.push_back( counters.back() );
+			for( ; i < block.last; ++ i )
+			{
+				out.push_back( vm.ops[i] );
+			}
+		}
+		vm.ops.swap( out );
+		vm.buildLabels();
+	}
+
+	// after the run
+	bool write( const char* path )
+	{
+		ofstream out( path, ios::out | ios::binary );
+		out << PROFILE_MAGIC << " " << ops << " " << counters.size() << " " << hash << "\n";
+		for( int i = 0; i < counters.size(); ++ i )
+		{
+			char buffer[32];
+			sprintf( buffer, "%.0f\n", counters[i]->count );
+			out << buffer;
+		}
+		return out.good();
+	}
+
+	bool read( const char* path )
+	{
+		ifstream in( path, ios::in | ios::binary );
+		string magic;
+		int blocks = 0;
+		if( !( in >> magic >> ops >> blocks >> hash ) || magic != PROFILE_MAGIC || blocks < 0 )
+		{
+			return false;
+		}
+		counts.assign( blocks, 0 );
+		for( int i = 0; i < blocks; ++ i )
+		{
+			if( !( in >> counts[i] ) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// false if the profile is of another program
+	bool layout( Vm& vm )
+	{
+		Cfg cfg( vm );
+		int n = cfg.blocks.size();
+		if( ops != vm.ops.size() || counts.size() != n || hash != hashOf( vm ) )
+		{
+			return false;
+		}
+
+		// the op behind a call has to stay there
+		vector< bool > glued( n, false );
+		for( int b = 1; b < n; ++ b )
+		{
+			int code = lastOf( vm, cfg, b - 1 )->getCode();
+			glued[b] = ( code == opCall || code == opCallMemo );
+		}
+
+		vector< int > seeds;
+		for( int b2 = 1; b2 < n; ++ b2 )
+		{
+			seeds.push_back( b2 );
+		}
+		stable_sort( seeds.begin(), seeds.end(), Hotter( counts ) );
+		if( n )
+		{
+			seeds.insert( seeds.begin(), 0 );
+		}
+
+		vector< bool > placed( n, false );
+		vector< int > order;
+		for( int s = 0; s < seeds.size(); ++ s )
+		{
+			int b3 = seeds[s];
+			if( placed[b3] || glued[b3] )
+			{
+				continue;
+			}
+			while( b3 >= 0 )
+			{
+				placed[b3] = true;
+				order.push_back( b3 );
+				b3 = follow( vm, cfg, b3, glued, placed );
+			}
+		}
+
+		// which blocks are jumped to now and need a label for it
+		vector< int > labelOf( n + 1, -1 );
+		for( int b4 = 0; b4 < n; ++ b4 )
+		{
+			Op* first = vm.ops[ cfg.blocks[b4].first ];
+			if( first->isLabel() )
+			{
+				labelOf[b4] = ( (OpLabel*) first )->label;
+			}
+		}
+		vector< bool > newLabel( n, false );
+		for( int k = 0; k < order.size(); ++ k )
+		{
+			int b5 = order[k];
+			int next = b5 + 1;
+			if( Cfg::fallsThrough( lastOf( vm, cfg, b5 ) ) && next < n &&
+				!( k + 1 < order.size() && order[k + 1] == next ) && labelOf[next] < 0 )
+			{
+				char name[32];
+				sprintf( name, "layout %d", next );
+				labelOf[next] = vm.labelIds.intern( name, strlen( name ) );
+				newLabel[next] = true;
+			}
+		}
+
+		vector< Op* > out;
+		for( int k2 = 0; k2 < order.size(); ++ k2 )
+		{
+			int b6 = order[k2];
+			Block& block = cfg.blocks[b6];
+			int following = ( k2 + 1 < order.size() ) ? order[k2 + 1] : n;
+			moved += ( b6 != k2 );
+			if( newLabel[b6] )
+			{
+				out.push_back( ARENA_NEW( vm.arena, OpLabel )( labelOf[b6] ) );
+			}
+
+			Op* last = lastOf( vm, cfg, b6 );
+			int end = block.last;
+			if( last->getCode() == opJump && vm.labels[ ( (OpLabel*) last )->label ] < vm.ops.size() &&
+				cfg.blockOf[ vm.labels[ ( (OpLabel*) last )->label ] ] == following )
+			{
+				-- end;
+				++ jumpsDropped;
+			}
+			for( int i = block.first; i < end; ++ i )
+			{
+				out.push_back( vm.ops[i] );
+			}
+
+			if( Cfg::fallsThrough( last ) && b6 + 1 != following )
+			{
+				if( b6 + 1 < n )
+				{
+					out.push_back( ARENA_NEW( vm.arena, OpJump )( labelOf[b6 + 1] ) );
+				}
+				else
+				{
+					// it fell off the end of the program
+					int length = 0;
+					out.push_back( ARENA_NEW( vm.arena, OpExit )( NULL, 0, length ) );
+				}
+				++ jumpsAdded;
+			}
+		}
+		vm.ops.swap( out );
+		vm.buildLabels();
+		return true;
+	}
+
+	void dump( ostream& out )
+	{
+		out << "layout: " << moved << " of " << counts.size() << " blocks moved, "
+			<< jumpsAdded << " jumps added, " << jumpsDropped << " dropped" << endl;
+	}
+
+protected:
+	class Hotter
+	{
+	public:
+		vector< double >& counts;
+
+		Hotter( vector< double >& _counts )
+			:counts( _counts )
+		{
+		}
+
+		bool operator()( int a, int b ) const
+		{
+			return counts[a] > counts[b];
+		}
+	};
+
+	// fnv-1a of what the trace of -d shows of every op
+	static unsigned hashOf( Vm& vm )
+	{
+		unsigned h = 2166136261u;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			ostringstream info;
+			vm.ops[i]->getRunInfo( info );
+			info << "\n";
+			string text = info.str();
+			for( int i2 = 0; i2 < text.length(); ++ i2 )
+			{
+				h = ( h ^ (unsigned char) text[i2] ) * 16777619u;
+			}
+		}
+		return h;
+	}
+
+	static Op* lastOf( Vm& vm, Cfg& cfg, int b )
+	{
+		return vm.ops[ cfg.blocks[b].last - 1 ];
+	}
+
+	// the block that should come right behind b, -1 if none should
+	int follow( Vm& vm, Cfg& cfg, int b, vector< bool >& glued, vector< bool >& placed )
+	{
+		int n = cfg.blocks.size();
+		Op* last = lastOf( vm, cfg, b );
+		int code = last->getCode();
+		int fall = ( Cfg::fallsThrough( last ) && b + 1 < n ) ? b + 1 : -1;
+		if( code == opCall || code == opCallMemo )
+		{
+			return fall;
+		}
+
+		int target = -1;
+		if( code == opJump || code == opJumpZ || code == opJumpN )
+		{
+			int at = vm.labels[ ( (OpLabel*) last )->label ];
+			target = ( at < vm.ops.size() ) ? cfg.blockOf[at] : -1;
+		}
+
+		// hot code does not go on into cold code
+		if( fall >= 0 && !placed[fall] && ( counts[fall] > 0 || counts[b] == 0 ) &&
+			( target < 0 || counts[fall] >= counts[target] || placed[target] || glued[target] ) )
+		{
+			return fall;
+		}
+		if( target >= 0 && !placed[target] && !glued[target] && ( counts[target] > 0 || counts[b] == 0 ) )
+		{
+			return target;
+		}
+		return -1;
+	}
+};
@@ -0,0 +1,258 @@
+// caps on what a program may use, with -L
+//
+//	-L instructions=n,seconds=s,stack=n,calls=n,heap=bytes
+//
+// Instructions are paid for a block at a time: apply() puts an OpCharge with
+// the length of the block in front of every block, in place of its label if
+// it has one, and it takes that from Vm::gas.  Only when the gas runs out
+// refuel() looks at the budget and the clock and hands out the next slice, so
+// the limits cost one subtraction per block.  A block is only entered if the
+// budget still covers all of it.  The time is looked at once per slice; a
+// program waiting for input is not stopped before the input is there.
+//
+// The stacks get smaller guards instead of checks, so a stack limit is
+// rounded up to a whole page.  The heap limit is checked where the heap
+// grows; without one a store to a huge address asks for all of that memory
+// and ends with "out of memory" when it is not there.  A run that hits a
+// limit ends like any runtime error, main returns the status that tells
+// which one it was.
+
+enum
+{
+	statusOk,
+	statusError,	// any other runtime error
+	statusInstructions,
+	statusTime,
+	statusStack,
+	statusCalls,
+	statusHeap
+};
+
+class Limits
+{
+public:
+	double instructions;	// 0 for no limit
+	double seconds;
+	int stack;	// values
+	int calls;
+	int heap;	// bytes
+	bool counted;	// charge without limits, for used()
+	double charged;	// instructions paid for
+	int slice;	// of gas, refuel() hands out at most this much
+
+protected:
+	int given;	// by the last refuel()
+	double started;
+
+public:
+	Limits()
+		:instructions( 0 ),
+		seconds( 0 ),
+		stack( 0 ),
+		calls( 0 ),
+		heap( 0 ),
+		counted( false ),
+		charged( 0 ),
+		slice( 100000 ),
+		given( 0 ),
+		started( 0 )
+	{
+	}
+
+	// name=value,..., false if one of them makes no sense
+	bool parse( const string& spec )
+	{
+		int at = 0;
+		while( at < spec.length() )
+		{
+			int end = spec.find( ',', at );
+			if( end < 0 )
+			{
+				end = spec.length();
+			}
+			string item = spec.substr( at, end - at );
+			at = end + 1;
+
+			int equals = item.find( '=' );
+			if( equals < 0 )
+			{
+				return false;
+			}
+			string name = item.substr( 0, equals );
+			char* rest = NULL;
+			double v = strtod( item.c_str() + equals + 1, &rest );
+			if( *rest || v <= 0 )
+			{
+				return false;
+			}
+			if( name == "instructions" )
+			{
+				instructions = v;
+			}
+			else if( name == "seconds" )
+			{
+				seconds = v;
+			}
+			else if( name == "stack" && v <= INT_MAX )
+			{
+				stack = (int) v;
+			}
+			else if( name == "calls" && v <= INT_MAX )
+			{
+				calls = (int) v;
+			}
+			else if( name == "heap" && v <= INT_MAX )
+			{
+				heap = (int) v;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// after the optimizer and the Memoizer, before buildIr
+	void apply( Vm& vm )
+	{
+		vm.limits = this;
+		if( stack )
+		{
+			vm.stack.setCapacity( stack );
+		}
+		if( calls )
+		{
+			vm.calls.setCapacity( calls );
+		}
+		if( heap )
+		{
+			vm.heapLimit = heap / sizeof( int );
+		}
+		if( instructions || seconds || counted )
+		{
+			charge( vm );
+		}
+		restart( vm );
+	}
+
+	// for another run of a vm that has been reset
+	void restart( Vm& vm )
+	{
+		started = metricsClock();
+		charged = 0;
+		given = 0;
+		vm.gas = 0;
+	}
+
+	void refuel( Vm& vm )
+	{
+		charged += given - vm.gas;
+		given = 0;
+		vm.gas = 0;
+		if( instructions && charged > instructions )
+		{
+			vm.stop( "instruction limit" );
+			return;
+		}
+		if( seconds && metricsClock() - started > seconds )
+		{
+			vm.stop( "time limit" );
+			return;
+		}
+		given = slice;
+		if( instructions && instructions - charged < slice )
+		{
+			given = (int) ( instructions - charged );
+		}
+		vm.gas = given;
+	}
+
+	// what an OpIdiom does at once, false leaves it to the loop
+	bool pay( Vm& vm, double n )
+	{
+		if( instructions && used( vm ) + n > instructions )
+		{
+			return false;
+		}
+		charged += n;
+		return true;
+	}
+
+	// instructions paid for so far, a block is paid for when it is entered
+	double used( Vm& vm )
+	{
+		return charged + given - vm.gas;
+	}
+
+	// what main returns for a run that stopped with error
+	static int statusOf( const char* error )
+	{
+		if( !error )
+		{
+			return statusOk;
+		}
+		if( strcmp( error, "instruction limit" ) == 0 )
+		{
+			return statusInstructions;
+		}
+		if( strcmp( error, "time limit" ) == 0 )
+		{
+			return statusTime;
+		}
+		if( strcmp( error, "operand stack overflow" ) == 0 )
+		{
+			return statusStack;
+		}
+		if( strcmp( error, "call stack overflow" ) == 0 )
+		{
+			return statusCalls;
+		}
+		if( strcmp( error, "heap limit" ) == 0 )
+		{
+			return statusHeap;
+		}
+		return statusError;
+	}
+
+protected:
+	// an OpCharge in front of every block, the OpMemoSave stays right behind
+	// its OpCallMemo
+	void charge( Vm& vm )
+	{
+		Cfg cfg( vm );
+		vector< Op* > out;
+		for( int b = 0; b < cfg.blocks.size(); ++ b )
+		{
+			Block& block = cfg.blocks[b];
+			int i = block.first;
+			int label = -1;
+			if( vm.ops[i]->isLabel() )
+			{
+				label = ( (OpLabel*) vm.ops[i ++] )->label;
+			}
+			else if( vm.ops[i]->getCode() == opMemoSave )
+			{
+				out.push_back( vm.ops[i ++] );
+			}
+			// a label is no instruction, like for the Metrics
+			out.push_back( ARENA_NEW( vm.arena, OpCharge )( label, block.last - block.first - ( label >= 0 ) ) );
+			for( ; i < block.last; ++ i )
+			{
+				out.push_back( vm.ops[i] );
+			}
+		}
+		vm.ops.swap( out );
+		vm.buildLabels();
+	}
+};
+
+void Vm::refuel()
+{
+	limits->refuel( *this );
+}
+
+bool Vm::pay( double instructions )
+{
+	return !limits || limits->pay( *this, instructions );
+}
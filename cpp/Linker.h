@@ -0,0 +1,236 @@
+// links modules that were assembled on their own, with --link
+//
+// Every .wsa is assembled into a .wso next to it, unless the .wso there came
+// from the same source and options; so only what changed is assembled again.
+// The modules an include names are found the way the Assembler finds
+// includes, and every one is linked once.  The first module runs first, the
+// others follow in the order they were found.  A label that is exported is
+// one label for the whole program, the others stay with their module, and
+// the heap regions get their cells one after another from heapBase on.
+
+class Linker
+{
+public:
+	vector< string > includePaths;
+	map< string, bool > options;
+	int heapBase;
+	string code;	// of the program
+	vector< string > errors;
+	int assembled;	// modules
+	int cached;
+
+protected:
+	vector< Module > modules;
+	vector< string > paths;	// of the modules
+	map< string, int > symbols;	// exported names, id in the program
+	map< string, string > exporters;	// name, path
+	int labels;	// ids given out
+
+public:
+	Linker()
+		:heapBase( 0 ),
+		assembled( 0 ),
+		cached( 0 ),
+		labels( 0 )
+	{
+	}
+
+	// the modules in files and what they include
+	bool link( const vector< string >& files )
+	{
+		map< string, bool > queued;
+		vector< string > queue( files );
+		for( int i = 0; i < queue.size(); ++ i )
+		{
+			queued[queue[i]] = true;
+		}
+		for( int i2 = 0; i2 < queue.size(); ++ i2 )
+		{
+			Module m;
+			if( !load( queue[i2], m ) )
+			{
+				continue;
+			}
+			for( int r = 0; r < m.required.size(); ++ r )
+			{
+				string path = Assembler::findFile( m.required[r], ".wsa", queue[i2], includePaths );
+				if( path.empty() )
+				{
+					path = Assembler::findFile( m.required[r], ".wso", queue[i2], includePaths );
+				}
+				if( path.empty() )
+				{
+					errors.push_back( queue[i2] + ": can not find include " + m.required[r] );
+				}
+				else if( !queued[path] )
+				{
+					queued[path] = true;
+					queue.push_back( path );
+				}
+			}
+			modules.push_back( m );
+			paths.push_back( queue[i2] );
+		}
+		if( errors.size() )
+		{
+			return false;
+		}
+
+		for( int k = 0; k < modules.size(); ++ k )
+		{
+			map< string, int >::iterator it;
+			for( it = modules[k].exports.begin(); it != modules[k].exports.end(); ++ it )
+			{
+				if( symbols.find( it->first ) != symbols.end() )
+				{
+					errors.push_back( paths[k] + ": label " + it->first + " is exported by " + exporters[it->first] + " too" );
+					continue;
+				}
+				symbols[it->first] = labels ++;
+				exporters[it->first] = paths[k];
+			}
+		}
+
+		int heap = heapBase;
+		for( int k2 = 0; k2 < modules.size(); ++ k2 )
+		{
+			Module& m = modules[k2];
+			vector< int > ids( m.labelCount, -1 );
+			map< string, int >::iterator it2;
+			for( it2 = m.exports.begin(); it2 != m.exports.end(); ++ it2 )
+			{
+				ids[it2->second] = symbols[it2->first];
+			}
+			for( it2 = m.imports.begin(); it2 != m.imports.end(); ++ it2 )
+			{
+				if( symbols.find( it2->first ) == symbols.end() )
+				{
+					errors.push_back( paths[k2] + ": label " + it2->first + " is nowhere" );
+					continue;
+				}
+				ids[it2->second] = symbols[it2->first];
+			}
+			for( int id = 0; id < ids.size(); ++ id )
+			{
+				if( ids[id] < 0 )
+				{
+					ids[id] = labels ++;
+				}
+			}
+
+			vector< int > bases;
+			for( int h = 0; h < m.heapSizes.size(); ++ h )
+			{
+				bases.push_back( heap );
+				heap += m.heapSizes[h];
+			}
+			relocate( m, paths[k2], ids, bases );
+		}
+		return errors.empty();
+	}
+
+protected:
+	// from the .wso, or assembled if there is none that fits
+	bool load( const string& path, Module& m )
+	{
+		string data;
+		if( path.length() > 4 && path.compare( path.length() - 4, 4, ".wso" ) == 0 )
+		{
+			if( !Assembler::readFile( path, data ) || !m.read( data ) )
+			{
+				errors.push_back( path + ": not a module" );
+				return false;
+			}
+			++ cached;
+			return true;
+		}
+
+		string source;
+		if( !Assembler::readFile( path, source ) )
+		{
+			errors.push_back( path + ": can not read" );
+			return false;
+		}
+		int dot = path.find_last_of( '.' );
+		string object = ( ( dot > (int) path.find_last_of( "/\\" ) ) ? path.substr( 0, dot ) : path ) + ".wso";
+		if( Assembler::readFile( object, data ) && m.read( data ) &&
+			m.source == Assembler::hashOf( source ) && m.options == Assembler::optionList( options ) )
+		{
+			++ cached;
+			return true;
+		}
+
+		Assembler assembler;
+		assembler.module = true;
+		assembler.includePaths = includePaths;
+		assembler.options = options;
+		if( !assembler.assembleFile( path ) )
+		{
+			errors.insert( errors.end(), assembler.errors.begin(), assembler.errors.end() );
+			return false;
+		}
+		m = Module();
+		assembler.toModule( m );
+
+		// a cache that can not be written is no reason to fail
+		ofstream out( object.c_str(), ios::out | ios::binary );
+		out << m.write();
+		++ assembled;
+		return true;
+	}
+
+	// appends the code of m with the ids and heap addresses of the program
+	void relocate( Module& m, const string& path, vector< int >& ids, vector< int >& bases )
+	{
+		const char* s = m.code.data();
+		int n = m.code.length();
+		int at = 0;
+		int index = 0;	// of the op
+		int r = 0;	// next relocation
+		while( at < n )
+		{
+			const AssemblerOp* op = NULL;
+			int sigLength = 0;
+			for( int i = 0; i < assemblerOpCount && !op; ++ i )
+			{
+				sigLength = strlen( assemblerOps[i].signature );
+				if( m.code.compare( at, sigLength, assemblerOps[i].signature ) == 0 )
+				{
+					op = &assemblerOps[i];
+				}
+			}
+			if( !op )
+			{
+				errors.push_back( path + ": broken code" );
+				return;
+			}
+			code += op->signature;
+			at += sigLength;
+
+			int length = 0;
+			if( op->arg != argNone )
+			{
+				int v = parseNumber( s + at, n - at, length );
+				if( length < 0 )
+				{
+					errors.push_back( path + ": broken code" );
+					return;
+				}
+				at += length;
+				if( op->arg == argLabel )
+				{
+					Assembler::encodeLabel( code, ( v >= 0 && v < ids.size() ) ? ids[v] : labels ++ );
+				}
+				else
+				{
+					for( ; r < m.relocations.size() && m.relocations[r].first == index; ++ r )
+					{
+						v += bases[ m.relocations[r].second ];
+					}
+					Assembler::encodeNumber( code, v );
+				}
+			}
+			++ index;
+		}
+	}
+};
@@ -0,0 +1,454 @@
+// memoization of pure subroutines, with -m
+//
+// A subroutine is pure if whatever it does depends on the top k values of
+// the stack only: it does not touch the heap, does no io, only calls pure
+// subroutines and leaves the stack at the same height on every way to its
+// ret.  Calls of a pure subroutine become OpCallMemo, which looks the k
+// values up in a cache of the results of earlier calls.  On a hit it puts
+// the results on the stack without calling, on a miss it calls as usual
+// and the OpMemoSave behind it puts what came back into the cache.
+
+class MemoTable
+{
+public:
+	int at;	// op index of the subroutine
+	int inputs;	// k, popped by the call
+	int outputs;	// pushed by the call
+	int calls;
+	int hits;
+
+protected:
+	int slots;
+	vector< bool > used;
+	vector< int > entries;	// inputs then outputs of every slot
+	vector< int > pendingDepth;	// vm.calls.size() of the calls that missed
+	vector< int > pendingKeys;
+
+public:
+	MemoTable( int _at, int _inputs, int _outputs, int _slots = 4096 )
+		:at( _at ),
+		inputs( _inputs ),
+		outputs( _outputs ),
+		calls( 0 ),
+		hits( 0 ),
+		slots( _slots )
+	{
+		used.assign( slots, false );
+		entries.resize( slots * ( inputs + outputs ) );
+	}
+
+	// true and the results on the stack if the top inputs values were seen
+	// before, if not the call has to run and save() gets the results
+	bool lookUp( Vm& vm )
+	{
+		++ calls;
+		int n = vm.stack.size();
+		if( n < inputs )
+		{
+			// it will fail, but not here
+			return false;
+		}
+		const int* key = inputs ? &vm.stack[n - inputs] : NULL;
+		int slot = slotOf( key );
+		int* entry = &entries[ slot * ( inputs + outputs ) ];
+		if( used[slot] && equal( key, key + inputs, entry ) )
+		{
+			++ hits;
+			for( int i = 0; i < inputs; ++ i )
+			{
+				vm.stack.pop_back();
+			}
+			for( int i2 = 0; i2 < outputs; ++ i2 )
+			{
+				vm.stack.push_back( entry[inputs + i2] );
+			}
+			return true;
+		}
+		pendingDepth.push_back( vm.calls.size() );
+		pendingKeys.insert( pendingKeys.end(), key, key + inputs );
+		return false;
+	}
+
+	// right after the ret of a call that missed
+	void save( Vm& vm )
+	{
+		// calls that did not come back here, a run that failed
+		int depth = vm.calls.size();
+		while( pendingDepth.size() && pendingDepth.back() > depth )
+		{
+			dropPending();
+		}
+		if( pendingDepth.empty() || pendingDepth.back() != depth )
+		{
+			return;
+		}
+
+		int n = vm.stack.size();
+		if( n >= outputs )
+		{
+			const int* key = inputs ? &pendingKeys[ pendingKeys.size() - inputs ] : NULL;
+			int slot = slotOf( key );
+			int* entry = &entries[ slot * ( inputs + outputs ) ];
+			copy( key, key + inputs, entry );
+			for( int i = 0; i < outputs; ++ i )
+			{
+				entry[inputs + i] = vm.stack[n - outputs + i];
+			}
+			used[slot] = true;
+		}
+		dropPending();
+	}
+
+protected:
+	int slotOf( const int* key )
+	{
+		unsigned h = 2166136261u;
+		for( int i = 0; i < inputs; ++ i )
+		{
+			h = ( h ^ (unsigned) key[i] ) * 16777619u;
+		}
+		return h % slots;
+	}
+
+	void dropPending()
+	{
+		pendingDepth.pop_back();
+		pendingKeys.resize( pendingKeys.size() - inputs );
+	}
+};
+
+class OpCallMemo: public OpLabel
+{
+public:
+	MemoTable* memo;
+
+	OpCallMemo( int _label, MemoTable* _memo )
+		:OpLabel( _label ),
+		memo( _memo )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "call memo";
+	}
+
+	virtual int getCode()
+	{
+		return opCallMemo;
+	}
+
+	virtual bool isLabel() { return false; };
+
+	virtual void run( class Vm& vm )
+	{
+		if( memo->lookUp( vm ) )
+		{
+			// past the OpMemoSave
+			++ vm.ip;
+			return;
+		}
+		vm.calls.push_back( vm.ip );
+		vm.ip = vm.labels[label];
+	}
+};
+
+class OpMemoSave: public Op
+{
+public:
+	MemoTable* memo;
+
+	OpMemoSave( MemoTable* _memo )
+		:memo( _memo )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "memo save";
+	}
+
+	virtual int getCode()
+	{
+		return opMemoSave;
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		memo->save( vm );
+	}
+};
+
+class Memoizer
+{
+public:
+	vector< MemoTable* > tables;
+	int minOps;	// smaller subroutines are cheaper to run than to look up
+	int maxInputs;
+
+	Memoizer()
+		:minOps( 8 ),
+		maxInputs( 4 )
+	{
+	}
+
+	~Memoizer()
+	{
+		for( int i = 0; i < tables.size(); ++ i )
+		{
+			delete tables[i];
+		}
+	}
+
+	// the program must be linked, ops keeps running with the tables
+	void run( Vm& vm )
+	{
+		int count = vm.ops.size();
+		map< int, MemoTable* > tableOf;	// op index of the subroutine
+		for( int i = 0; i < count; ++ i )
+		{
+			Op* op = vm.ops[i];
+			if( op->getCode() == opCall && vm.labels[ ( (OpLabel*) op )->label ] < count )
+			{
+				tableOf[ vm.labels[ ( (OpLabel*) op )->label ] ] = NULL;
+			}
+		}
+
+		// what a pure subroutine does to the stack, none for the others;
+		// recursive ones need a few rounds, their calls do not come back
+		// until the way without them is known
+		map< int, Summary > summaries;
+		bool changed = true;
+		for( int round = 0; changed && round < 64; ++ round )
+		{
+			changed = false;
+			map< int, MemoTable* >::iterator it;
+			for( it = tableOf.begin(); it != tableOf.end(); ++ it )
+			{
+				Summary s = summarize( vm, it->first, summaries );
+				if( !( s == summaries[it->first] ) )
+				{
+					summaries[it->first] = s;
+					changed = true;
+				}
+			}
+		}
+		if( changed )
+		{
+			return;
+		}
+
+		map< int, Summary >::iterator it2;
+		for( it2 = summaries.begin(); it2 != summaries.end(); ++ it2 )
+		{
+			Summary& s = it2->second;
+			if( s.state == Summary::pure && s.inputs <= maxInputs && s.ops >= minOps )
+			{
+				MemoTable* table = new MemoTable( it2->first, s.inputs, s.inputs + s.height );
+				tables.push_back( table );
+				tableOf[it2->first] = table;
+			}
+		}
+		if( tables.empty() )
+		{
+			return;
+		}
+
+		vector< Op* > out;
+		vector< int > moved( count );	// where every op goes
+		for( int i3 = 0; i3 < count; ++ i3 )
+		{
+			Op* op = vm.ops[i3];
+			moved[i3] = out.size();
+			MemoTable* table = NULL;
+			if( op->getCode() == opCall && vm.labels[ ( (OpLabel*) op )->label ] < count )
+			{
+				table = tableOf[ vm.labels[ ( (OpLabel*) op )->label ] ];
+			}
+			if( table )
+			{
+				out.push_back( ARENA_NEW( vm.arena, OpCallMemo )( ( (OpLabel*) op )->label, table ) );
+				out.push_back( ARENA_NEW( vm.arena, OpMemoSave )( table ) );
+			}
+			else
+			{
+				out.push_back( op );
+			}
+		}
+		vm.ops.swap( out );
+		vm.buildLabels();
+		for( int i4 = 0; i4 < tables.size(); ++ i4 )
+		{
+			tables[i4]->at = moved[ tables[i4]->at ];
+		}
+	}
+
+	void dump( ostream& out )
+	{
+		for( int i = 0; i < tables.size(); ++ i )
+		{
+			MemoTable& t = *tables[i];
+			out << "memo at " << t.at << " (" << t.inputs << " -> " << t.outputs << "): "
+				<< t.hits << " hits of " << t.calls << " calls";
+			if( t.calls )
+			{
+				out << " (" << 100 * (double) t.hits / t.calls << "%)";
+			}
+			out << endl;
+		}
+	}
+
+protected:
+	class Summary
+	{
+	public:
+		enum
+		{
+			unknown,	// no way to the ret known yet
+			pure,
+			impure
+		};
+
+		int state;
+		int inputs;	// values below the stack it starts with that it reads
+		int height;	// of the stack at the ret, to where it started
+		int ops;	// that it runs itself
+
+		Summary()
+			:state( unknown ),
+			inputs( 0 ),
+			height( 0 ),
+			ops( 0 )
+		{
+		}
+
+		bool operator==( const Summary& other ) const
+		{
+			return state == other.state && inputs == other.inputs &&
+				height == other.height && ops == other.ops;
+		}
+	};
+
+	// walks every way from the op at start to a ret, with the height of the
+	// stack at every op
+	Summary summarize( Vm& vm, int start, map< int, Summary >& summaries )
+	{
+		Summary s;
+		int count = vm.ops.size();
+		map< int, int > heightAt;
+		vector< pair< int, int > > work;	// op index, height
+		work.push_back( make_pair( start, 0 ) );
+		int low = 0;	// lowest height read
+		bool returns = false;
+		while( work.size() )
+		{
+			int i = work.back().first;
+			int h = work.back().second;
+			work.pop_back();
+			if( i >= count )
+			{
+				// runs off the end, the program stops
+				s.state = Summary::impure;
+				return s;
+			}
+			map< int, int >::iterator seen = heightAt.find( i );
+			if( seen != heightAt.end() )
+			{
+				if( seen->second != h )
+				{
+					// a loop that grows or shrinks the stack
+					s.state = Summary::impure;
+					return s;
+				}
+				continue;
+			}
+			heightAt[i] = h;
+
+			Op* op = vm.ops[i];
+			int code = op->getCode();
+			int pops = 0;
+			int pushes = 0;
+			switch( code )
+			{
+			case opPush:
+				pushes = 1;
+				break;
+			case opPop:
+			case opJumpZ:
+			case opJumpN:
+				pops = 1;
+				break;
+			case opDoub:
+				pops = 1;
+				pushes = 2;
+				break;
+			case opSwap:
+				pops = 2;
+				pushes = 2;
+				break;
+			case opAdd:
+			case opSub:
+			case opMul:
+			case opDiv:
+			case opMod:
+				pops = 2;
+				pushes = 1;
+				break;
+			case opLabel:
+			case opJump:
+				break;
+			case opCall:
+				{
+					int target = vm.labels[ ( (OpLabel*) op )->label ];
+					map< int, Summary >::iterator callee = summaries.find( target );
+					if( callee != summaries.end() && callee->second.state == Summary::impure )
+					{
+						s.state = Summary::impure;
+						return s;
+					}
+					if( callee == summaries.end() || callee->second.state == Summary::unknown )
+					{
+						// does not come back as far as we know yet
+						continue;
+					}
+					pops = callee->second.inputs;
+					pushes = callee->second.inputs + callee->second.height;
+				}
+				break;
+			case opRet:
+				if( returns && h != s.height )
+				{
+					s.state = Summary::impure;
+					return s;
+				}
+				returns = true;
+				s.height = h;
+				continue;
+			default:
+				// heap, io, exit and what is not known
+				s.state = Summary::impure;
+				return s;
+			}
+
+			low = __min( low, h - pops );
+			h += pushes - pops;
+
+			if( code == opJump || code == opJumpZ || code == opJumpN )
+			{
+				work.push_back( make_pair( vm.labels[ ( (OpLabel*) op )->label ], h ) );
+			}
+			if( code != opJump )
+			{
+				work.push_back( make_pair( i + 1, h ) );
+			}
+		}
+
+		if( returns )
+		{
+			s.state = Summary::pure;
+			s.inputs = -low;
+			s.ops = heightAt.size();
+		}
+		return s;
+	}
+};
@@ -0,0 +1,264 @@
+// counters of a running program, with -M
+//
+// Once attach()ed the Vm calls count() before every op it runs and its io
+// goes through a MeteredIo.  Like the trace of -d this needs the ops, so -M
+// runs do not use the Ir, and the loop only pays for it when it is on.
+// print() writes the counters as one line of JSON; main does that when the
+// program ends, and on SIGUSR1 the next count() does it while the program
+// runs.  An op that waits for input is dispatched again when the input is
+// there.  The heap is one vector, so every page up to the highest cell that
+// was used counts as touched.  Io time is what the calls of the Io took
+// plus the time the Vm was suspended between two resume()s.
+
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+
+static volatile sig_atomic_t metricsRequested = 0;
+
+#ifndef WIN32
+void onMetricsSignal( int sig )
+{
+	metricsRequested = 1;
+}
+#endif
+
+// seconds since some time in the past
+double metricsClock()
+{
+#ifdef WIN32
+	return GetTickCount() / 1000.0;
+#else
+	struct timeval now;
+	gettimeofday( &now, NULL );
+	return now.tv_sec + now.tv_usec / 1000000.0;
+#endif
+}
+
+class Metrics;
+
+class MeteredIo: public Io
+{
+public:
+	Io* inner;
+	Metrics* metrics;
+
+	MeteredIo()
+		:inner( NULL ),
+		metrics( NULL )
+	{
+	}
+
+	virtual bool getChar( int& ch );
+	virtual bool getNumber( int& v );
+	virtual bool write( const char* p, int n );
+	virtual bool putChar( char ch );
+	virtual bool putNumber( int v );
+
+	virtual void error( const char* p, int n )
+	{
+		inner->error( p, n );
+	}
+
+	virtual void flush()
+	{
+		inner->flush();
+	}
+};
+
+class Metrics
+{
+public:
+	vector< double > dispatches;	// by OpCode
+	int peakStack;
+	int peakCalls;
+	double bytesIn;	// numbers count with the digits they have and a line end
+	double bytesOut;
+	double ioSeconds;
+	double started;
+	double suspendedAt;	// 0 while running
+	MeteredIo io;
+	Vm* vm;
+	ostream* out;
+
+	Metrics()
+		:dispatches( opCount + 1, 0 ),
+		peakStack( 0 ),
+		peakCalls( 0 ),
+		bytesIn( 0 ),
+		bytesOut( 0 ),
+		ioSeconds( 0 ),
+		started( metricsClock() ),
+		suspendedAt( 0 ),
+		vm( NULL ),
+		out( &cerr )
+	{
+		io.metrics = this;
+	}
+
+	// after the Vm got its io
+	void attach( Vm& _vm )
+	{
+		vm = &_vm;
+		vm->metrics = this;
+		io.inner = vm->io;
+		vm->io = &io;
+#ifndef WIN32
+		signal( SIGUSR1, onMetricsSignal );
+#endif
+	}
+
+	void count( int code )
+	{
+		++ dispatches[code];
+		peakStack = __max( peakStack, vm->stack.size() );
+		peakCalls = __max( peakCalls, vm->calls.size() );
+		if( metricsRequested )
+		{
+			metricsRequested = 0;
+			print( *out );
+		}
+	}
+
+	void resumed()
+	{
+		if( suspendedAt )
+		{
+			ioSeconds += metricsClock() - suspendedAt;
+			suspendedAt = 0;
+		}
+	}
+
+	void suspended()
+	{
+		suspendedAt = metricsClock();
+	}
+
+	// the ops of the program that ran, not the labels or what -L, -F or -t
+	// put in, so the count is the same with and without them
+	double instructions()
+	{
+		double sum = 0;
+		for( int i = 0; i < dispatches.size(); ++ i )
+		{
+			if( i != opLabel && i != opCharge && i != opCount )
+			{
+				sum += dispatches[i];
+			}
+		}
+		return sum;
+	}
+
+	void print( ostream& o )
+	{
+		if( !vm )
+		{
+			return;
+		}
+		o << "{\"instructions\":" << number( instructions() )
+			<< ",\"dispatches\":{";
+		bool first = true;
+		for( int i2 = 0; i2 < dispatches.size(); ++ i2 )
+		{
+			if( dispatches[i2] )
+			{
+				o << ( first ? "" : "," ) << "\"" << opCodeNames[i2] << "\":" << number( dispatches[i2] );
+				first = false;
+			}
+		}
+		o << "}"
+			<< ",\"calls\":" << number( dispatches[opCall] + dispatches[opCallMemo] )
+			<< ",\"returns\":" << number( dispatches[opRet] )
+			<< ",\"peakStack\":" << peakStack
+			<< ",\"peakCalls\":" << peakCalls
+			<< ",\"heapPages\":" << ( vm->heap.size() * sizeof( int ) + 4095 ) / 4096
+			<< ",\"bytesIn\":" << number( bytesIn )
+			<< ",\"bytesOut\":" << number( bytesOut )
+			<< ",\"ioSeconds\":" << seconds( ioSeconds )
+			<< ",\"seconds\":" << seconds( metricsClock() - started )
+			<< "}" << endl;
+	}
+
+protected:
+	static string number( double v )
+	{
+		char buffer[32];
+		sprintf( buffer, "%.0f", v );
+		return buffer;
+	}
+
+	static string seconds( double v )
+	{
+		char buffer[32];
+		sprintf( buffer, "%.6f", v );
+		return buffer;
+	}
+};
+
+bool MeteredIo::getChar( int& ch )
+{
+	double start = metricsClock();
+	bool ok = inner->getChar( ch );
+	metrics->ioSeconds += metricsClock() - start;
+	if( ok && ch >= 0 )
+	{
+		++ metrics->bytesIn;
+	}
+	return ok;
+}
+
+bool MeteredIo::getNumber( int& v )
+{
+	double start = metricsClock();
+	bool ok = inner->getNumber( v );
+	metrics->ioSeconds += metricsClock() - start;
+	if( ok )
+	{
+		char buffer[16];
+		metrics->bytesIn += sprintf( buffer, "%d", v ) + 1;
+	}
+	return ok;
+}
+
+bool MeteredIo::write( const char* p, int n )
+{
+	double start = metricsClock();
+	bool ok = inner->write( p, n );
+	metrics->ioSeconds += metricsClock() - start;
+	metrics->bytesOut += n;
+	return ok;
+}
+
+bool MeteredIo::putChar( char ch )
+{
+	double start = metricsClock();
+	bool ok = inner->putChar( ch );
+	metrics->ioSeconds += metricsClock() - start;
+	++ metrics->bytesOut;
+	return ok;
+}
+
+bool MeteredIo::putNumber( int v )
+{
+	double start = metricsClock();
+	bool ok = inner->putNumber( v );
+	metrics->ioSeconds += metricsClock() - start;
+	char buffer[16];
+	metrics->bytesOut += sprintf( buffer, "%d", v );
+	return ok;
+}
+
+void Vm::meter( int code )
+{
+	metrics->count( code );
+}
+
+void Vm::meterResume()
+{
+	metrics->resumed();
+}
+
+void Vm::meterSuspend()
+{
+	metrics->suspended();
+}
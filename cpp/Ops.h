@@ -1,65 +1,71 @@
-class OpPush: public Op
+// Quick variants
+//
+// Some ops rewrite themselves into a specialised quick variant the first time
+// they run (see Vm::quicken).  A quick variant checks a cheap guard and does
+// the fast thing; if the guard fails the generic op it replaced does the work.
+// Variants whose guard keeps failing put the generic op back for good.
+class OpQuick: public Op
 {
-	int value;
-
 public:
-	OpPush( string& s, int& length )
+	Op* generic;
+	int misses;
+
+	OpQuick( Op* _generic )
+		:generic( _generic ),
+		misses( 0 )
 	{
-		if( s.length() == 0 )
-		{
-			length = -1;
-			value = 0;
-			return;
-		}
+	}
 
-		int i = 0;
+	virtual char* getName( )
+	{
+		return generic->getName();
+	}
 
-		int _sign = 1;
-		int _value = 0;
-		if( s[0] == 'a' )
-		{
-			_sign = +1;
-			++ i;
-		}
-		else if( s[0] == 'b' )
-		{
-			_sign = -1;
-			++ i;
-		}
-		else if( s[0] == 'c' )
-		{
-		}
+	virtual void getRunInfo( ostream& out )
+	{
+		generic->getRunInfo( out );
+		out << " (quick)";
+	}
 
-		while( ( i < s.length() ) && ( s[i] != 'c' ) )
-		{
-			if( s[i] == 'a' )
-			{
-				_value = 2 * _value;
-			}
-			else if( s[i] == 'b' )
-			{
-				_value = 2 * _value + 1;
-			}
-			
-			++ i;
-		}
+	virtual Op* getGeneric()
+	{
+		return generic;
+	}
 
-		++ i;
-		value = _sign * _value;
+	virtual int getCode()
+	{
+		return generic->getCode();
+	}
 
-		if( i <= s.length() )
-		{
-			length = i;
-		}
-		else
+	void miss( class Vm& vm )
+	{
+		if( ++ misses >= 16 )
 		{
-			length = -1;
+			generic->deoptimized = true;
+			vm.quicken( this, generic );
 		}
+		generic->runGeneric( vm );
+	}
+};
+
+class OpPush: public Op
+{
+public:
+	int value;
+
+	OpPush( int _value )
+		:value( _value )
+	{
+	}
+
+	OpPush( const char* s, int n, int& length )
+	{
+		value = parseNumber( s, n, length );
 	}
 
 	static char* getSignature()
 	{
-		return "aa";
+		return SIGNATURE_PUSH;
 	}
 
 	virtual char* getName( )
@@ -67,6 +73,11 @@ public:
 		return "push";
 	}
 
+	virtual int getCode()
+	{
+		return opPush;
+	}
+
 	virtual void getRunInfo( ostream& out )
 	{
 		out << getName() << " " << value;
@@ -82,13 +93,13 @@ public:
 class OpPop: public Op
 {
 public:
-	OpPop( string& s, int& length )
+	OpPop( const char* s, int n, int& length )
 	{
 	}
 
 	static char* getSignature()
 	{
-		return "acc";
+		return SIGNATURE_POP;
 	}
 
 	virtual char* getName( )
@@ -96,6 +107,11 @@ public:
 		return "pop";
 	}
 
+	virtual int getCode()
+	{
+		return opPop;
+	}
+
 	virtual void run( class Vm& vm )
 	{
 		vm.stack.pop_back();
@@ -106,47 +122,25 @@ class OpLabel: public Op
 {
 public:
 //protected:
-	int label;
+	int label;	// id from vm.labelIds
+	const char* text;	// the bits of the label, only until intern()
+	int textLength;
 	virtual bool isLabel() { return true; };
 
 public:
-	OpLabel( string& s, int& length )
+	OpLabel( int _label )
+		:label( _label ),
+		text( NULL ),
+		textLength( 0 )
 	{
-		if( s.length() == 0 )
-		{
-			length = -1;
-			label = 0;
-			return;
-		}
-
-		int i = 0;
-
-		int _value = 1;
-		while( ( i < s.length() ) && ( s[i] != 'c' ) )
-		{
-			if( s[i] == 'a' )
-			{
-				_value = 2 * _value;
-			}
-			else if( s[i] == 'b' )
-			{
-				_value = 2 * _value + 1;
-			}
-			
-			++ i;
-		}
-
-		++ i;
-		label = _value;
+	}
 
-		if( i <= s.length() )
-		{
-			length = i;
-		}
-		else
-		{
-			length = -1;
-		}
+	OpLabel( const char* s, int n, int& length )
+		:label( -1 ),
+		text( s ),
+		textLength( 0 )
+	{
+		textLength = parseLabel( s, n, length );
 	}
 
 	virtual char* getName( )
@@ -154,9 +148,14 @@ public:
 		return "label";
 	}
 
+	virtual int getCode()
+	{
+		return opLabel;
+	}
+
 	static char* getSignature()
 	{
-		return "caa";
+		return SIGNATURE_LABEL;
 	}
 
 	virtual void getRunInfo( ostream& out )
@@ -164,6 +163,12 @@ public:
 		out << getName() << " " << label;
 	}
 
+	virtual void intern( class Vm& vm )
+	{
+		label = vm.labelIds.intern( text, textLength );
+		text = NULL;
+	}
+
 	virtual void run( class Vm& vm )
 	{
 	}
@@ -172,7 +177,7 @@ public:
 class OpDoub: public Op
 {
 public:
-	OpDoub( string& s, int& length )
+	OpDoub( const char* s, int n, int& length )
 	{
 	}
 
@@ -181,14 +186,18 @@ public:
 		return "doub";
 	}
 
+	virtual int getCode()
+	{
+		return opDoub;
+	}
+
 	static char* getSignature()
 	{
-		return "aca";
+		return SIGNATURE_DOUB;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() > 0 );
 		vm.stack.push_back( vm.stack.back() );
 	}
 };
@@ -196,7 +205,7 @@ public:
 class OpSwap: public Op
 {
 public:
-	OpSwap( string& s, int& length )
+	OpSwap( const char* s, int n, int& length )
 	{
 	}
 
@@ -205,14 +214,18 @@ public:
 		return "swap";
 	}
 
+	virtual int getCode()
+	{
+		return opSwap;
+	}
+
 	static char* getSignature()
 	{
-		return "acb";
+		return SIGNATURE_SWAP;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
 		int size = vm.stack.size();
 		swap( vm.stack[ size - 2 ], vm.stack[ size - 1] );
 	}
@@ -221,7 +234,7 @@ public:
 class OpAdd: public Op
 {
 public:
-	OpAdd( string& s, int& length )
+	OpAdd( const char* s, int n, int& length )
 	{
 	}
 
@@ -230,25 +243,26 @@ public:
 		return "add";
 	}
 
+	virtual int getCode()
+	{
+		return opAdd;
+	}
+
 	static char* getSignature()
 	{
-		return "baaa";
+		return SIGNATURE_ADD;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
-		int size = vm.stack.size();
-		int i = vm.stack[ size - 2 ] + vm.stack[ size - 1];
-		vm.stack.pop_back();
-		vm.stack.back() = i;
+		runAdd( vm.stack );
 	}
 };
 
 class OpSub: public Op
 {
 public:
-	OpSub( string& s, int& length )
+	OpSub( const char* s, int n, int& length )
 	{
 	}
 
@@ -257,25 +271,26 @@ public:
 		return "sub";
 	}
 
+	virtual int getCode()
+	{
+		return opSub;
+	}
+
 	static char* getSignature()
 	{
-		return "baab";
+		return SIGNATURE_SUB;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
-		int size = vm.stack.size();
-		int i = vm.stack[ size - 2 ] - vm.stack[ size - 1];
-		vm.stack.pop_back();
-		vm.stack.back() = i;
+		runSub( vm.stack );
 	}
 };
 
 class OpMul: public Op
 {
 public:
-	OpMul( string& s, int& length )
+	OpMul( const char* s, int n, int& length )
 	{
 	}
 
@@ -284,25 +299,26 @@ public:
 		return "mul";
 	}
 
+	virtual int getCode()
+	{
+		return opMul;
+	}
+
 	static char* getSignature()
 	{
-		return "baac";
+		return SIGNATURE_MUL;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
-		int size = vm.stack.size();
-		int i = vm.stack[ size - 2 ] * vm.stack[ size - 1];
-		vm.stack.pop_back();
-		vm.stack.back() = i;
+		runMul( vm.stack );
 	}
 };
 
 class OpDiv: public Op
 {
 public:
-	OpDiv( string& s, int& length )
+	OpDiv( const char* s, int n, int& length )
 	{
 	}
 
@@ -311,25 +327,31 @@ public:
 		return "div";
 	}
 
+	virtual int getCode()
+	{
+		return opDiv;
+	}
+
 	static char* getSignature()
 	{
-		return "baba";
+		return SIGNATURE_DIV;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
-		int size = vm.stack.size();
-		int i = vm.stack[ size - 2 ] / vm.stack[ size - 1];
-		vm.stack.pop_back();
-		vm.stack.back() = i;
+		if( vm.stack.back() == 0 )
+		{
+			vm.stop( "division by zero" );
+			return;
+		}
+		runDiv( vm.stack );
 	}
 };
 
 class OpMod: public Op
 {
 public:
-	OpMod( string& s, int& length )
+	OpMod( const char* s, int n, int& length )
 	{
 	}
 
@@ -338,25 +360,57 @@ public:
 		return "mod";
 	}
 
+	virtual int getCode()
+	{
+		return opMod;
+	}
+
 	static char* getSignature()
 	{
-		return "babb";
+		return SIGNATURE_MOD;
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		if( vm.stack.back() == 0 )
+		{
+			vm.stop( "division by zero" );
+			return;
+		}
+		runMod( vm.stack );
+	}
+};
+
+// store to an address inside the heap
+class OpQuickStore: public OpQuick
+{
+public:
+	OpQuickStore( Op* generic )
+		:OpQuick( generic )
+	{
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
 		int size = vm.stack.size();
-		int i = vm.stack[ size - 2 ] % vm.stack[ size - 1];
-		vm.stack.pop_back();
-		vm.stack.back() = i;
+		unsigned i = vm.stack[ size - 2 ];
+		if( i < vm.heap.size() )
+		{
+			vm.heap[i] = vm.stack[ size - 1];
+			vm.stack.pop_back();
+			vm.stack.pop_back();
+		}
+		else
+		{
+			miss( vm );
+		}
 	}
 };
 
 class OpStore: public Op
 {
 public:
-	OpStore( string& s, int& length )
+	OpStore( const char* s, int n, int& length )
 	{
 	}
 
@@ -365,14 +419,27 @@ public:
 		return "store";
 	}
 
+	virtual int getCode()
+	{
+		return opStore;
+	}
+
 	static char* getSignature()
 	{
-		return "bba";
+		return SIGNATURE_STORE;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 2 );
+		if( !deoptimized )
+		{
+			vm.quicken( this, ARENA_NEW( vm.arena, OpQuickStore )( this ) );
+		}
+		runGeneric( vm );
+	}
+
+	virtual void runGeneric( class Vm& vm )
+	{
 		int size = vm.stack.size();
 		int i = vm.stack[ size - 2 ];
 		int v = vm.stack[ size - 1];
@@ -384,10 +451,33 @@ public:
 	}
 };
 
+// retrive from an address inside the heap
+class OpQuickRetrive: public OpQuick
+{
+public:
+	OpQuickRetrive( Op* generic )
+		:OpQuick( generic )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		unsigned i = vm.stack.back();
+		if( i < vm.heap.size() )
+		{
+			vm.stack.back() = vm.heap[i];
+		}
+		else
+		{
+			miss( vm );
+		}
+	}
+};
+
 class OpRetrive: public Op
 {
 public:
-	OpRetrive( string& s, int& length )
+	OpRetrive( const char* s, int n, int& length )
 	{
 	}
 
@@ -396,26 +486,122 @@ public:
 		return "retrive";
 	}
 
+	virtual int getCode()
+	{
+		return opRetrive;
+	}
+
 	static char* getSignature()
 	{
-		return "bbb";
+		return SIGNATURE_RETRIVE;
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		if( !deoptimized )
+		{
+			vm.quicken( this, ARENA_NEW( vm.arena, OpQuickRetrive )( this ) );
+		}
+		runGeneric( vm );
+	}
+
+	virtual void runGeneric( class Vm& vm )
+	{
+		unsigned i = vm.stack.back();
+		if( i >= vm.heap.size() )
+		{
+			vm.stop( "heap address out of range" );
+			return;
+		}
+		vm.stack.back() = vm.heap[i];
+	}
+};
+
+
+// flow control with the label already looked up, labels do not move once
+// the program is linked so there is nothing to guard
+class OpQuickCall: public OpQuick
+{
+public:
+	int target;
+
+	OpQuickCall( Op* generic, int _target )
+		:OpQuick( generic ),
+		target( _target )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		vm.calls.push_back( vm.ip );
+		vm.ip = target;
+	}
+};
+
+class OpQuickJump: public OpQuick
+{
+public:
+	int target;
+
+	OpQuickJump( Op* generic, int _target )
+		:OpQuick( generic ),
+		target( _target )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		vm.ip = target;
+	}
+};
+
+class OpQuickJumpZ: public OpQuick
+{
+public:
+	int target;
+
+	OpQuickJumpZ( Op* generic, int _target )
+		:OpQuick( generic ),
+		target( _target )
+	{
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
-		assert( vm.stack.back() >= 0 );
-		assert( vm.heap.size() >= vm.stack.back() );
-		vm.stack.back() = vm.heap[ vm.stack.back() ];
+		if( vm.stack.back() == 0 )
+		{
+			vm.ip = target;
+		}
+		vm.stack.pop_back();
 	}
 };
 
+class OpQuickJumpN: public OpQuick
+{
+public:
+	int target;
+
+	OpQuickJumpN( Op* generic, int _target )
+		:OpQuick( generic ),
+		target( _target )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		if( vm.stack.back() < 0 )
+		{
+			vm.ip = target;
+		}
+		vm.stack.pop_back();
+	}
+};
 
 class OpCall: public OpLabel
 {
 public:
-	OpCall( string& s, int& length )
-		: OpLabel( s, length )
+	OpCall( const char* s, int n, int& length )
+		: OpLabel( s, n, length )
 	{
 	}
 
@@ -424,28 +610,38 @@ public:
 		return "call";
 	}
 
+	virtual int getCode()
+	{
+		return opCall;
+	}
+
 	virtual bool isLabel() { return false; };
 
 	static char* getSignature()
 	{
-		return "cab";
+		return SIGNATURE_CALL;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-//		vm.stack.push_back( vm.ip );
-		vm.stack.insert( vm.stack.begin(), vm.ip );
+		int target = vm.labels[label];
+		vm.quicken( this, ARENA_NEW( vm.arena, OpQuickCall )( this, target ) );
 
-		assert( vm.labels.find( label ) != vm.labels.end() );
-		vm.ip = vm.labels[label];
+		vm.calls.push_back( vm.ip );
+		vm.ip = target;
 	}
 };
 
 class OpJump: public OpLabel
 {
 public:
-	OpJump( string& s, int& length )
-		: OpLabel( s, length )
+	OpJump( const char* s, int n, int& length )
+		: OpLabel( s, n, length )
+	{
+	}
+
+	OpJump( int _label )
+		: OpLabel( _label )
 	{
 	}
 
@@ -454,25 +650,31 @@ public:
 		return "jump";
 	}
 
+	virtual int getCode()
+	{
+		return opJump;
+	}
+
 	virtual bool isLabel() { return false; };
 
 	static char* getSignature()
 	{
-		return "cac";
+		return SIGNATURE_JUMP;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.labels.find( label ) != vm.labels.end() );
-		vm.ip = vm.labels[label];
+		int target = vm.labels[label];
+		vm.quicken( this, ARENA_NEW( vm.arena, OpQuickJump )( this, target ) );
+		vm.ip = target;
 	}
 };
 
 class OpJumpZ: public OpLabel
 {
 public:
-	OpJumpZ( string& s, int& length )
-		: OpLabel( s, length )
+	OpJumpZ( const char* s, int n, int& length )
+		: OpLabel( s, n, length )
 	{
 	}
 
@@ -481,20 +683,26 @@ public:
 		return "jumpz";
 	}
 
+	virtual int getCode()
+	{
+		return opJumpZ;
+	}
+
 	virtual bool isLabel() { return false; };
 
 	static char* getSignature()
 	{
-		return "cba";
+		return SIGNATURE_JUMPZ;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
+		int target = vm.labels[label];
+		vm.quicken( this, ARENA_NEW( vm.arena, OpQuickJumpZ )( this, target ) );
+
 		if( vm.stack.back() == 0 )
 		{
-			assert( vm.labels.find( label ) != vm.labels.end() );
-			vm.ip = vm.labels[label];
+			vm.ip = target;
 		}
 		vm.stack.pop_back();
 	}
@@ -503,8 +711,8 @@ public:
 class OpJumpN: public OpLabel
 {
 public:
-	OpJumpN( string& s, int& length )
-		: OpLabel( s, length )
+	OpJumpN( const char* s, int n, int& length )
+		: OpLabel( s, n, length )
 	{
 	}
 
@@ -513,20 +721,26 @@ public:
 		return "jumpn";
 	}
 
+	virtual int getCode()
+	{
+		return opJumpN;
+	}
+
 	virtual bool isLabel() { return false; };
 
 	static char* getSignature()
 	{
-		return "cbb";
+		return SIGNATURE_JUMPN;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
+		int target = vm.labels[label];
+		vm.quicken( this, ARENA_NEW( vm.arena, OpQuickJumpN )( this, target ) );
+
 		if( vm.stack.back() < 0 )
 		{
-			assert( vm.labels.find( label ) != vm.labels.end() );
-			vm.ip = vm.labels[label];
+			vm.ip = target;
 		}
 		vm.stack.pop_back();
 	}
@@ -535,7 +749,7 @@ public:
 class OpRet: public Op
 {
 public:
-	OpRet( string& s, int& length )
+	OpRet( const char* s, int n, int& length )
 	{
 	}
 
@@ -544,26 +758,27 @@ public:
 		return "ret";
 	}
 
+	virtual int getCode()
+	{
+		return opRet;
+	}
+
 	static char* getSignature()
 	{
-		return "cbc";
+		return SIGNATURE_RET;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
-//		vm.ip = vm.stack.back();
-		vm.ip = vm.stack.front();
-//		vm.stack.erase( vm.stack.front(), vm.stack.front() + 1 );
-		vm.stack.erase( vm.stack.begin(), vm.stack.begin() + 1 );
-		//vm.stack.pop_back();
+		vm.ip = vm.calls.back();
+		vm.calls.pop_back();
 	}
 };
 
 class OpExit: public Op
 {
 public:
-	OpExit( string& s, int& length )
+	OpExit( const char* s, int n, int& length )
 	{
 	}
 
@@ -572,9 +787,14 @@ public:
 		return "exit";
 	}
 
+	virtual int getCode()
+	{
+		return opExit;
+	}
+
 	static char* getSignature()
 	{
-		return "ccc";
+		return SIGNATURE_EXIT;
 	}
 
 	virtual void run( class Vm& vm )
@@ -586,7 +806,7 @@ public:
 class OpOutC: public Op
 {
 public:
-	OpOutC( string& s, int& length )
+	OpOutC( const char* s, int n, int& length )
 	{
 	}
 
@@ -595,23 +815,31 @@ public:
 		return "outc";
 	}
 
+	virtual int getCode()
+	{
+		return opOutC;
+	}
+
 	static char* getSignature()
 	{
-		return "bcaa";
+		return SIGNATURE_OUTC;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
-		cout << (char) vm.stack.back();
+		bool more = vm.io->putChar( (char) vm.stack.back() );
 		vm.stack.pop_back();
+		if( !more )
+		{
+			vm.suspend( false );
+		}
 	}
 };
 
 class OpOutN: public Op
 {
 public:
-	OpOutN( string& s, int& length )
+	OpOutN( const char* s, int n, int& length )
 	{
 	}
 
@@ -620,23 +848,404 @@ public:
 		return "outn";
 	}
 
+	virtual int getCode()
+	{
+		return opOutN;
+	}
+
 	static char* getSignature()
 	{
-		return "bcab";
+		return SIGNATURE_OUTN;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
-		cout << vm.stack.back();
+		bool more = vm.io->putNumber( vm.stack.back() );
 		vm.stack.pop_back();
+		if( !more )
+		{
+			vm.suspend( false );
+		}
+	}
+};
+
+// outc of a run of pushed characters, made by PassFuseOutput, the bytes
+// live in the arena like the op
+class OpOutS: public Op
+{
+public:
+	char* bytes;
+	int length;
+
+	OpOutS( Arena& arena, const string& s )
+		:bytes( (char*) arena.alloc( s.length() ) ),
+		length( s.length() )
+	{
+		memcpy( bytes, s.data(), length );
+	}
+
+	virtual char* getName( )
+	{
+		return "outs";
+	}
+
+	virtual int getCode()
+	{
+		return opOutS;
+	}
+
+	virtual void getRunInfo( ostream& out )
+	{
+		out << getName() << " " << length;
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		if( !vm.io->write( bytes, length ) )
+		{
+			vm.suspend( false );
+		}
+	}
+};
+
+// first op of a block when Limits count instructions, pays for the whole
+// block up front; it takes the place of the label of the block if there is
+// one, label is -1 if not
+class OpCharge: public OpLabel
+{
+public:
+	int cost;	// ops in the block
+
+	OpCharge( int _label, int _cost )
+		:OpLabel( _label ),
+		cost( _cost )
+	{
+	}
+
+	virtual bool isLabel() { return label >= 0; };
+
+	virtual char* getName( )
+	{
+		return "charge";
+	}
+
+	virtual int getCode()
+	{
+		return opCharge;
+	}
+
+	virtual void getRunInfo( ostream& out )
+	{
+		out << getName() << " " << cost;
+	}
+
+	virtual void intern( class Vm& vm )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		vm.gas -= cost;
+		if( vm.gas < 0 )
+		{
+			vm.refuel();
+		}
+	}
+};
+
+// counts the runs of its block while a Profile is collected with -F
+class OpCount: public Op
+{
+public:
+	double count;
+
+	OpCount()
+		:count( 0 )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "count";
+	}
+
+	virtual int getCode()
+	{
+		return opCount;
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		++ count;
+	}
+};
+
+// a label while the program runs on the ops with -t, counts how often its
+// block is entered and tells the Tier once that is hotness times
+class OpHot: public OpLabel
+{
+public:
+	int count;
+
+	OpHot( int _label )
+		:OpLabel( _label ),
+		count( 0 )
+	{
+	}
+
+	virtual void intern( class Vm& vm )
+	{
+	}
+
+	virtual void run( class Vm& vm )
+	{
+		if( ++ count >= vm.hotness )
+		{
+			vm.tierUp();
+		}
+	}
+};
+
+// the loops PassLoopIdioms finds, run in one go.  Such an op sits at the
+// top of its loop and runs all turns of it but the last, so the loop ends
+// right after it the way it always did.  If the state is not what the idiom
+// needs (a string without its 0, a negative count, ...) it does nothing and
+// the loop runs as it is.
+class OpIdiom: public Op
+{
+public:
+	int cost;	// instructions of one round of the loop, this op included
+
+	OpIdiom( int _cost )
+		:cost( _cost )
+	{
+	}
+
+	virtual int getCode()
+	{
+		return opOther;
+	}
+
+	// the Limits are charged for every round the loop would have run
+	virtual void run( class Vm& vm )
+	{
+		if( guard( vm ) && vm.pay( rounds( vm ) * cost ) )
+		{
+			bulk( vm );
+		}
+	}
+
+	virtual bool guard( class Vm& vm ) = 0;
+
+	// that bulk() does, after guard()
+	virtual double rounds( class Vm& vm ) = 0;
+
+	virtual void bulk( class Vm& vm ) = 0;
+};
+
+// label l; doub; retrive; doub; jumpz e; outc; push 1; add; jump l
+class OpIdiomPutsHeap: public OpIdiom
+{
+	int end;	// of the string, set by guard
+
+public:
+	OpIdiomPutsHeap()
+		:OpIdiom( 9 )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "idiom puts heap";
+	}
+
+	virtual double rounds( class Vm& vm )
+	{
+		return end - vm.stack.back();
+	}
+
+	virtual bool guard( class Vm& vm )
+	{
+		if( vm.stack.size() < 1 || vm.stack.back() < 0 )
+		{
+			return false;
+		}
+		for( end = vm.stack.back(); end < vm.heap.size(); ++ end )
+		{
+			if( vm.heap[end] == 0 )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual void bulk( class Vm& vm )
+	{
+		int start = vm.stack.back();
+		string s( end - start, 0 );
+		for( int i = start; i < end; ++ i )
+		{
+			s[i - start] = (char) vm.heap[i];
+		}
+		vm.stack.back() = end;
+		if( s.length() && !vm.io->write( s.data(), s.length() ) )
+		{
+			vm.suspend( false );
+		}
+	}
+};
+
+// label l; doub; jumpz e; outc; jump l, prints the stack down to a 0
+class OpIdiomPutsStack: public OpIdiom
+{
+	int end;	// index of the 0
+
+public:
+	OpIdiomPutsStack()
+		:OpIdiom( 5 )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "idiom puts stack";
+	}
+
+	virtual double rounds( class Vm& vm )
+	{
+		return vm.stack.size() - 1 - end;
+	}
+
+	virtual bool guard( class Vm& vm )
+	{
+		for( end = vm.stack.size() - 1; end >= 0; -- end )
+		{
+			if( vm.stack[end] == 0 )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual void bulk( class Vm& vm )
+	{
+		string s;
+		while( vm.stack.size() - 1 > end )
+		{
+			s += (char) vm.stack.back();
+			vm.stack.pop_back();
+		}
+		if( s.length() && !vm.io->write( s.data(), s.length() ) )
+		{
+			vm.suspend( false );
+		}
+	}
+};
+
+// label l; doub; jumpz e; swap; doub; push v; store; push 1; add; swap;
+// push 1; sub; jump l, fills n cells from a with v for a stack of a, n
+class OpIdiomFill: public OpIdiom
+{
+	int value;
+
+public:
+	OpIdiomFill( int _value )
+		:OpIdiom( 13 ),
+		value( _value )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "idiom fill";
+	}
+
+	virtual double rounds( class Vm& vm )
+	{
+		return vm.stack.back();
+	}
+
+	virtual bool guard( class Vm& vm )
+	{
+		if( vm.stack.size() < 2 )
+		{
+			return false;
+		}
+		double a = vm.stack[ vm.stack.size() - 2 ];
+		double n = vm.stack.back();
+		return a >= 0 && n >= 0 && a + n <= vm.heapLimit;
+	}
+
+	virtual void bulk( class Vm& vm )
+	{
+		int a = vm.stack[ vm.stack.size() - 2 ];
+		int n = vm.stack.back();
+		if( n )
+		{
+			vm.heap.resize( __max( vm.heap.size(), a + n ) );
+			fill( vm.heap.begin() + a, vm.heap.begin() + a + n, value );
+		}
+		vm.stack[ vm.stack.size() - 2 ] = a + n;
+		vm.stack.back() = 0;
+	}
+};
+
+// label l; doub; doub; store; push 1; add; doub; push c; retrive; sub;
+// jumpz e; jump l, sets every cell from a up to heap[c] to its address
+class OpIdiomIota: public OpIdiom
+{
+	int cell;
+	int end;	// heap[cell], set by guard
+
+public:
+	OpIdiomIota( int _cell )
+		:OpIdiom( 12 ),
+		cell( _cell )
+	{
+	}
+
+	virtual char* getName( )
+	{
+		return "idiom iota";
+	}
+
+	virtual double rounds( class Vm& vm )
+	{
+		return end - 1 - vm.stack.back();
+	}
+
+	virtual bool guard( class Vm& vm )
+	{
+		if( vm.stack.size() < 1 || cell < 0 || cell >= vm.heap.size() )
+		{
+			return false;
+		}
+		int a = vm.stack.back();
+		end = vm.heap[cell];
+		return a >= 0 && a < end && end <= vm.heapLimit && ( cell < a || cell >= end );
+	}
+
+	virtual void bulk( class Vm& vm )
+	{
+		// the loop does the last cell
+		int a = vm.stack.back();
+		int last = end - 1;
+		vm.heap.resize( __max( vm.heap.size(), last ) );
+		int* h = vm.heap.size() ? &vm.heap[0] : NULL;
+		for( int i = a; i < last; ++ i )
+		{
+			h[i] = i;
+		}
+		vm.stack.back() = last;
 	}
 };
 
 class OpInC: public Op
 {
 public:
-	OpInC( string& s, int& length )
+	OpInC( const char* s, int n, int& length )
 	{
 	}
 
@@ -645,18 +1254,25 @@ public:
 		return "inc";
 	}
 
+	virtual int getCode()
+	{
+		return opInC;
+	}
+
 	static char* getSignature()
 	{
-		return "bcba";
+		return SIGNATURE_INC;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
-		char ch;
-//		cin >> ch;
-		cin.get( ch );
-		putInHeap( vm, vm.stack.back(), ch ); 
+		int ch;
+		if( !vm.io->getChar( ch ) )
+		{
+			vm.suspend( true );
+			return;
+		}
+		putInHeap( vm, vm.stack.back(), (char) ch ); 
 		vm.stack.pop_back();
 	}
 };
@@ -664,7 +1280,7 @@ public:
 class OpInN: public Op
 {
 public:
-	OpInN( string& s, int& length )
+	OpInN( const char* s, int n, int& length )
 	{
 	}
 
@@ -673,16 +1289,24 @@ public:
 		return "inn";
 	}
 
+	virtual int getCode()
+	{
+		return opInN;
+	}
+
 	static char* getSignature()
 	{
-		return "bcbb";
+		return SIGNATURE_INN;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		assert( vm.stack.size() >= 1 );
 		int v;
-		cin >> v;
+		if( !vm.io->getNumber( v ) )
+		{
+			vm.suspend( true );
+			return;
+		}
 		putInHeap( vm, vm.stack.back(), v ); 
 		vm.stack.pop_back();
 	}
@@ -691,7 +1315,7 @@ public:
 class OpDebugPrintStack: public Op
 {
 public:
-	OpDebugPrintStack( string& s, int& length )
+	OpDebugPrintStack( const char* s, int n, int& length )
 	{
 	}
 
@@ -702,28 +1326,30 @@ public:
 
 	static char* getSignature()
 	{
-		return "ccaaa";
+		return SIGNATURE_DEBUG_PRINT_STACK;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		cout << "Stack: [";
+		ostringstream out;
+		out << "Stack: [";
 		for( int i = 0; i < vm.stack.size(); ++ i )
 		{
 			 if( i > 0 )
 			 {
-				 cout << ",";
+				 out << ",";
 			 }
-			 cout << vm.stack[i];
+			 out << vm.stack[i];
 		}
-		cout << "]" << endl;
+		out << "]" << endl;
+		vm.io->write( out.str().c_str(), out.str().length() );
 	}
 };
 
 class OpDebugPrintHeap: public Op
 {
 public:
-	OpDebugPrintHeap( string& s, int& length )
+	OpDebugPrintHeap( const char* s, int n, int& length )
 	{
 	}
 
@@ -734,21 +1360,23 @@ public:
 
 	static char* getSignature()
 	{
-		return "ccaab";
+		return SIGNATURE_DEBUG_PRINT_HEAP;
 	}
 
 	virtual void run( class Vm& vm )
 	{
-		cout << "Heap: [";
+		ostringstream out;
+		out << "Heap: [";
 		for( int i = 0; i < vm.heap.size(); ++ i )
 		{
 			 if( i > 0 )
 			 {
-				 cout << ",";
+				 out << ",";
 			 }
-			 cout << vm.heap[i];
+			 out << vm.heap[i];
 		}
-		cout << "]" << endl;
+		out << "]" << endl;
+		vm.io->write( out.str().c_str(), out.str().length() );
 	}
 };
 
@@ -0,0 +1,572 @@
+// optimizations over Vm::ops
+//
+// Every Pass rewrites the ops of a linked program into ops that do the same
+// and links them again.  The Optimizer runs all passes over and over until
+// none of them finds anything more to do, one pass often makes work for the
+// next (a folded branch leaves code nobody can reach, which leaves labels
+// nobody jumps to, which lets two pushes meet).
+
+class Pass
+{
+public:
+	int changes;	// over all runs
+
+	Pass()
+		:changes( 0 )
+	{
+	}
+
+	virtual ~Pass()
+	{
+	}
+
+	virtual char* getName() = 0;
+
+	// returns how many ops it changed
+	virtual int run( Vm& vm ) = 0;
+
+protected:
+	void install( Vm& vm, vector< Op* >& ops )
+	{
+		vm.ops.swap( ops );
+		vm.buildLabels();
+	}
+
+	static bool isPush( Op* op )
+	{
+		return op->getCode() == opPush;
+	}
+
+	static int valueOf( Op* op )
+	{
+		return ( (OpPush*) op )->value;
+	}
+};
+
+// push a; push b; add -> push a + b, push a; pop -> nothing, and doub and
+// swap of pushes become pushes, so the arithmetic after them folds as well
+class PassFoldConstants: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "fold constants";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		vector< Op* > out;
+		int folded = 0;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			int code = op->getCode();
+			int n = out.size();
+			int v;
+			if( n >= 2 && isPush( out[n - 2] ) && isPush( out[n - 1] ) &&
+				fold( code, valueOf( out[n - 2] ), valueOf( out[n - 1] ), vm.checked, v ) )
+			{
+				out.pop_back();
+				out.pop_back();
+				out.push_back( ARENA_NEW( vm.arena, OpPush )( v ) );
+				folded += 2;
+			}
+			else if( code == opPop && n >= 1 && isPush( out[n - 1] ) )
+			{
+				out.pop_back();
+				folded += 2;
+			}
+			else if( code == opDoub && n >= 1 && isPush( out[n - 1] ) )
+			{
+				out.push_back( out[n - 1] );
+				++ folded;
+			}
+			else if( code == opSwap && n >= 2 && isPush( out[n - 2] ) && isPush( out[n - 1] ) )
+			{
+				swap( out[n - 2], out[n - 1] );
+				++ folded;
+			}
+			else
+			{
+				out.push_back( op );
+			}
+		}
+		if( folded )
+		{
+			install( vm, out );
+		}
+		return folded;
+	}
+
+	// false if code is no arithmetic or would fail at run time, which
+	// overflowing does when it is checked
+	static bool fold( int code, int a, int b, bool checked, int& v )
+	{
+		double exact;
+		switch( code )
+		{
+		case opAdd:
+			v = wrapAdd( a, b );
+			exact = (double) a + b;
+			return !checked || v == exact;
+		case opSub:
+			v = wrapSub( a, b );
+			exact = (double) a - b;
+			return !checked || v == exact;
+		case opMul:
+			v = wrapMul( a, b );
+			exact = (double) a * b;
+			return !checked || v == exact;
+		case opDiv:
+		case opMod:
+			if( b == 0 || ( b == -1 && a == INT_MIN ) )
+			{
+				return false;
+			}
+			v = ( code == opDiv ) ? a / b : a % b;
+			return true;
+		}
+		return false;
+	}
+};
+
+// push c; jumpz l -> jump l or nothing, the same for jumpn
+class PassFoldBranches: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "fold branches";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		vector< Op* > out;
+		int folded = 0;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			int code = op->getCode();
+			int n = out.size();
+			if( ( code == opJumpZ || code == opJumpN ) && n >= 1 && isPush( out[n - 1] ) )
+			{
+				int v = valueOf( out[n - 1] );
+				out.pop_back();
+				if( code == opJumpZ ? v == 0 : v < 0 )
+				{
+					out.push_back( ARENA_NEW( vm.arena, OpJump )( ( (OpLabel*) op )->label ) );
+				}
+				folded += 2;
+			}
+			else
+			{
+				out.push_back( op );
+			}
+		}
+		if( folded )
+		{
+			install( vm, out );
+		}
+		return folded;
+	}
+};
+
+class PassRemoveUnreachable: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "remove unreachable";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		Cfg cfg( vm );
+		vector< Op* > out;
+		for( int i = 0; i < cfg.blocks.size(); ++ i )
+		{
+			Block& b = cfg.blocks[i];
+			if( b.reachable )
+			{
+				out.insert( out.end(), vm.ops.begin() + b.first, vm.ops.begin() + b.last );
+			}
+		}
+		int removed = vm.ops.size() - out.size();
+		if( removed )
+		{
+			install( vm, out );
+		}
+		return removed;
+	}
+};
+
+class PassStripLabels: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "strip labels";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		vector< bool > used( vm.labels.size(), false );
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			int code = vm.ops[i]->getCode();
+			if( code == opCall || code == opJump || code == opJumpZ || code == opJumpN )
+			{
+				used[ ( (OpLabel*) vm.ops[i] )->label ] = true;
+			}
+		}
+
+		vector< Op* > out;
+		for( int i2 = 0; i2 < vm.ops.size(); ++ i2 )
+		{
+			Op* op = vm.ops[i2];
+			if( !op->isLabel() || used[ ( (OpLabel*) op )->label ] )
+			{
+				out.push_back( op );
+			}
+		}
+		int stripped = vm.ops.size() - out.size();
+		if( stripped )
+		{
+			install( vm, out );
+		}
+		return stripped;
+	}
+};
+
+// call x; ret -> jump x, x returns right to our caller then, so recursion
+// that ends in a call runs in constant call stack space
+class PassTailCalls: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "tail calls";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		int count = vm.ops.size();
+		int rewritten = 0;
+		for( int i = 0; i < count; ++ i )
+		{
+			Op* op = vm.ops[i];
+			if( op->getCode() != opCall )
+			{
+				continue;
+			}
+			int next = i + 1;
+			while( next < count && vm.ops[next]->isLabel() )
+			{
+				++ next;
+			}
+			if( next < count && vm.ops[next]->getCode() == opRet )
+			{
+				vm.ops[i] = ARENA_NEW( vm.arena, OpJump )( ( (OpLabel*) op )->label );
+				++ rewritten;
+			}
+		}
+		return rewritten;
+	}
+};
+
+// call x -> the body of x, if x is a few ops that run straight to a ret
+class PassInlineLeaves: public Pass
+{
+public:
+	int maxOps;
+
+	PassInlineLeaves()
+		:maxOps( 8 )
+	{
+	}
+
+	virtual char* getName()
+	{
+		return "inline leaves";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		vector< Op* > out;
+		int inlined = 0;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			int first, last;
+			if( op->getCode() == opCall && leaf( vm, vm.labels[ ( (OpLabel*) op )->label ], first, last ) )
+			{
+				out.insert( out.end(), vm.ops.begin() + first, vm.ops.begin() + last );
+				++ inlined;
+			}
+			else
+			{
+				out.push_back( op );
+			}
+		}
+		if( inlined )
+		{
+			install( vm, out );
+		}
+		return inlined;
+	}
+
+protected:
+	// the body of the subroutine at label, without the label and the ret
+	bool leaf( Vm& vm, int label, int& first, int& last )
+	{
+		first = label + 1;
+		for( last = first; last < vm.ops.size() && last - first <= maxOps; ++ last )
+		{
+			Op* op = vm.ops[last];
+			if( op->getCode() == opRet )
+			{
+				return true;
+			}
+			if( op->isLabel() || Cfg::endsBlock( op ) )
+			{
+				return false;
+			}
+		}
+		return false;
+	}
+};
+
+// push 'H'; outc; push 'i'; outc -> outs "Hi", one write for the whole
+// run.  Pushes in any order work as long as the run prints all of them.
+class PassFuseOutput: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "fuse output";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		vector< Op* > out;
+		int fused = 0;
+		int i = 0;
+		while( i < vm.ops.size() )
+		{
+			// the longest run of pushes, outcs and outs that leaves the
+			// stack as it found it
+			vector< Op* > pushes;
+			string bytes;
+			int ops = 0;
+			int end = i;
+			int endBytes = 0;
+			int endOps = 0;
+			for( int j = i; j < vm.ops.size(); ++ j )
+			{
+				Op* op = vm.ops[j];
+				int code = op->getCode();
+				if( code == opPush )
+				{
+					pushes.push_back( op );
+				}
+				else if( code == opOutC && pushes.size() )
+				{
+					bytes += (char) valueOf( pushes.back() );
+					pushes.pop_back();
+					++ ops;
+				}
+				else if( code == opOutS && pushes.empty() )
+				{
+					bytes.append( ( (OpOutS*) op )->bytes, ( (OpOutS*) op )->length );
+					++ ops;
+				}
+				else
+				{
+					break;
+				}
+				if( pushes.empty() )
+				{
+					end = j + 1;
+					endBytes = bytes.length();
+					endOps = ops;
+				}
+			}
+
+			// a lone outs is as fused as it gets
+			if( endOps >= 2 || ( endOps == 1 && vm.ops[i]->getCode() == opPush ) )
+			{
+				out.push_back( ARENA_NEW( vm.arena, OpOutS )( vm.arena, bytes.substr( 0, endBytes ) ) );
+				fused += end - i;
+				i = end;
+			}
+			else
+			{
+				out.push_back( vm.ops[i] );
+				++ i;
+			}
+		}
+		if( fused )
+		{
+			install( vm, out );
+		}
+		return fused;
+	}
+};
+
+// counted loops over the heap and string printing loops get an OpIdiom at
+// their top, see there
+class PassLoopIdioms: public Pass
+{
+public:
+	virtual char* getName()
+	{
+		return "loop idioms";
+	}
+
+	virtual int run( Vm& vm )
+	{
+		static const int putsHeap[] = { opDoub, opRetrive, opDoub, opJumpZ, opOutC, opPush, opAdd, opJump, -1 };
+		static const int putsStack[] = { opDoub, opJumpZ, opOutC, opJump, -1 };
+		static const int fill[] = { opDoub, opJumpZ, opSwap, opDoub, opPush, opStore, opPush, opAdd,
+			opSwap, opPush, opSub, opJump, -1 };
+		static const int iota[] = { opDoub, opDoub, opStore, opPush, opAdd, opDoub, opPush, opRetrive,
+			opSub, opJumpZ, opJump, -1 };
+
+		vector< Op* > out;
+		int found = 0;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			out.push_back( op );
+			if( !op->isLabel() )
+			{
+				continue;
+			}
+
+			int l = ( (OpLabel*) op )->label;
+			Op* idiom = NULL;
+			if( loop( vm, i, l, putsHeap ) && push( vm, i + 6, 1 ) )
+			{
+				idiom = ARENA_NEW( vm.arena, OpIdiomPutsHeap );
+			}
+			else if( loop( vm, i, l, putsStack ) )
+			{
+				idiom = ARENA_NEW( vm.arena, OpIdiomPutsStack );
+			}
+			else if( loop( vm, i, l, fill ) && push( vm, i + 7, 1 ) && push( vm, i + 10, 1 ) )
+			{
+				idiom = ARENA_NEW( vm.arena, OpIdiomFill )( valueOf( vm.ops[i + 5] ) );
+			}
+			else if( loop( vm, i, l, iota ) && push( vm, i + 4, 1 ) )
+			{
+				idiom = ARENA_NEW( vm.arena, OpIdiomIota )( valueOf( vm.ops[i + 7] ) );
+			}
+			if( idiom )
+			{
+				out.push_back( idiom );
+				++ found;
+			}
+		}
+		if( found )
+		{
+			install( vm, out );
+		}
+		return found;
+	}
+
+protected:
+	// the ops after the label at i are codes, -1 ended, the last jumps back
+	// to the label and the jumpz leaves the loop
+	static bool loop( Vm& vm, int i, int label, const int* codes )
+	{
+		int n = 0;
+		while( codes[n] >= 0 )
+		{
+			if( i + 1 + n >= vm.ops.size() || vm.ops[i + 1 + n]->getCode() != codes[n] )
+			{
+				return false;
+			}
+			++ n;
+		}
+		for( int k = 1; k <= n; ++ k )
+		{
+			Op* op = vm.ops[i + k];
+			int code = op->getCode();
+			if( code == opJumpZ && ( (OpLabel*) op )->label == label )
+			{
+				return false;
+			}
+			if( code == opJump && ( (OpLabel*) op )->label != label )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool push( Vm& vm, int i, int value )
+	{
+		return isPush( vm.ops[i] ) && valueOf( vm.ops[i] ) == value;
+	}
+};
+
+class Optimizer
+{
+public:
+	vector< Pass* > passes;
+	int opsBefore;
+	int opsAfter;
+	int rounds;
+
+	Optimizer()
+		:opsBefore( 0 ),
+		opsAfter( 0 ),
+		rounds( 0 )
+	{
+		passes.push_back( new PassTailCalls );
+		passes.push_back( new PassInlineLeaves );
+		passes.push_back( new PassFoldConstants );
+		passes.push_back( new PassFoldBranches );
+		passes.push_back( new PassRemoveUnreachable );
+		passes.push_back( new PassStripLabels );
+		passes.push_back( new PassFuseOutput );
+		passes.push_back( new PassLoopIdioms );
+	}
+
+	~Optimizer()
+	{
+		for( int i = 0; i < passes.size(); ++ i )
+		{
+			delete passes[i];
+		}
+	}
+
+	// the program must be linked
+	void run( Vm& vm )
+	{
+		opsBefore = vm.ops.size();
+		int changed;
+		do
+		{
+			changed = 0;
+			for( int i = 0; i < passes.size(); ++ i )
+			{
+				int n = passes[i]->run( vm );
+				passes[i]->changes += n;
+				changed += n;
+			}
+			++ rounds;
+		}
+		while( changed && rounds < 16 );
+		opsAfter = vm.ops.size();
+	}
+
+	void dump( ostream& out )
+	{
+		for( int i = 0; i < passes.size(); ++ i )
+		{
+			out << passes[i]->getName() << ": " << passes[i]->changes << " ops" << endl;
+		}
+		out << "ops: " << opsBefore << " -> " << opsAfter << " in " << rounds << " rounds" << endl;
+	}
+};
@@ -0,0 +1,434 @@
+// programs that run side by side in one process, with --pipe
+//
+//	wsinter --pipe first.ws second.ws third.ws [-r] [-O] [-m] [-c]
+//
+// runs like first | second | third in a shell, each program on a thread of
+// its own: what one prints with outc and outn the next one reads with inc
+// and inn.  Between two of them sits a Ring, a buffer that one thread only
+// writes and the other only reads, so neither takes a lock or makes a
+// system call for it; a side that has to wait yields its time slice.  The
+// writer makes what it wrote visible a chunk at a time, and before it waits
+// for input itself, so a byte at a time costs no barrier.  The first program
+// reads cin, the last writes cout, runtime errors go to cerr.  A program
+// that ends closes its Ring, the next one then reads the end of input; one
+// that writes to a program that ended ends as well, like on a broken pipe.
+
+#ifndef WIN32
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#ifdef WIN32
+#define RING_BARRIER() MemoryBarrier()
+#else
+#define RING_BARRIER() __sync_synchronize()
+#endif
+
+class Ring
+{
+public:
+	enum { size = 64 * 1024, chunk = 4 * 1024 };
+
+protected:
+	char bytes[size];
+
+	// the writer's side, each on a cache line of its own so the two threads
+	// do not write to the same one
+	volatile unsigned head;	// bytes written and visible
+	volatile bool closed;	// by the writer, after its last head
+	unsigned written;
+	unsigned tailSeen;
+	char pad[64];
+
+	// the reader's side
+	volatile unsigned tail;	// bytes read
+	volatile bool abandoned;	// the reader ended
+	unsigned read;
+	unsigned headSeen;
+
+public:
+	Ring()
+		:head( 0 ),
+		closed( false ),
+		written( 0 ),
+		tailSeen( 0 ),
+		tail( 0 ),
+		abandoned( false ),
+		read( 0 ),
+		headSeen( 0 )
+	{
+	}
+
+	// false once the reader is gone
+	bool write( const char* p, int n )
+	{
+		while( n > 0 )
+		{
+			if( written - tailSeen == size )
+			{
+				publish();
+				tailSeen = tail;
+				RING_BARRIER();
+				if( abandoned )
+				{
+					return false;
+				}
+				if( written - tailSeen == size )
+				{
+					wait();
+					continue;
+				}
+			}
+			int at = written % size;
+			int k = __min( n, __min( size - at, (int) ( size - ( written - tailSeen ) ) ) );
+			memcpy( bytes + at, p, k );
+			written += k;
+			p += k;
+			n -= k;
+			if( written - head >= chunk )
+			{
+				publish();
+			}
+		}
+		return !abandoned;
+	}
+
+	// makes what was written visible to the reader
+	void publish()
+	{
+		if( written != head )
+		{
+			RING_BARRIER();
+			head = written;
+		}
+	}
+
+	void close()
+	{
+		publish();
+		RING_BARRIER();
+		closed = true;
+	}
+
+	// true if peek() can answer without waiting
+	bool ready()
+	{
+		return read != headSeen;
+	}
+
+	// the next byte, -1 at the end of input; waits for it
+	int peek()
+	{
+		while( read == headSeen )
+		{
+			RING_BARRIER();
+			tail = read;
+			bool last = closed;
+			RING_BARRIER();
+			headSeen = head;
+			RING_BARRIER();
+			if( read != headSeen )
+			{
+				break;
+			}
+			if( last )
+			{
+				return -1;
+			}
+			wait();
+		}
+		return (unsigned char) bytes[read % size];
+	}
+
+	void next()
+	{
+		++ read;
+	}
+
+	void abandon()
+	{
+		RING_BARRIER();
+		abandoned = true;
+	}
+
+protected:
+	static void wait()
+	{
+#ifdef WIN32
+		Sleep( 0 );
+#else
+		sched_yield();
+#endif
+	}
+};
+
+// io of one program of a pipeline, a NULL Ring goes to cin or cout instead
+class RingIo: public Io
+{
+public:
+	Io* inner;
+	Ring* in;
+	Ring* out;
+	Vm* vm;
+
+	RingIo()
+		:inner( &stdIo ),
+		in( NULL ),
+		out( NULL ),
+		vm( NULL )
+	{
+	}
+
+	virtual bool getChar( int& ch )
+	{
+		if( !in )
+		{
+			return inner->getChar( ch );
+		}
+		waiting();
+		ch = in->peek();
+		if( ch >= 0 )
+		{
+			in->next();
+		}
+		return true;
+	}
+
+	// like cin >> v: white space, a sign and digits, the byte behind them
+	// stays for the next read
+	virtual bool getNumber( int& v )
+	{
+		if( !in )
+		{
+			return inner->getNumber( v );
+		}
+		waiting();
+		int ch = in->peek();
+		while( ch >= 0 && isspace( ch ) )
+		{
+			in->next();
+			ch = in->peek();
+		}
+		string digits;
+		if( ch == '-' || ch == '+' )
+		{
+			digits += (char) ch;
+			in->next();
+			ch = in->peek();
+		}
+		while( ch >= 0 && isdigit( ch ) )
+		{
+			digits += (char) ch;
+			in->next();
+			ch = in->peek();
+		}
+		v = atoi( digits.c_str() );
+		return true;
+	}
+
+	virtual bool write( const char* p, int n )
+	{
+		if( !out )
+		{
+			return inner->write( p, n );
+		}
+		if( !out->write( p, n ) )
+		{
+			// nobody reads any more
+			vm->running = false;
+		}
+		return true;
+	}
+
+	virtual bool putChar( char ch )
+	{
+		return write( &ch, 1 );
+	}
+
+	virtual bool putNumber( int v )
+	{
+		char buffer[16];
+		int n = sprintf( buffer, "%d", v );
+		return write( buffer, n );
+	}
+
+	virtual void error( const char* p, int n )
+	{
+		if( !out )
+		{
+			inner->error( p, n );
+			return;
+		}
+		flush();
+		cerr.write( p, n );
+	}
+
+	virtual void flush()
+	{
+		if( out )
+		{
+			out->publish();
+		}
+		else
+		{
+			inner->flush();
+		}
+	}
+
+protected:
+	// what was written goes out before this waits for more input
+	void waiting()
+	{
+		if( out && !in->ready() )
+		{
+			out->publish();
+		}
+	}
+};
+
+class Stage
+{
+public:
+	string path;
+	Vm vm;
+	Memoizer memoizer;
+	RingIo io;
+#ifdef WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+class Pipeline
+{
+public:
+	vector< Stage* > stages;
+	vector< Ring* > rings;	// rings[i] goes from stage i to stage i + 1
+	bool registers;
+	bool optimize;
+	bool memoize;
+	bool checked;
+
+	Pipeline()
+		:registers( false ),
+		optimize( false ),
+		memoize( false ),
+		checked( false )
+	{
+	}
+
+	~Pipeline()
+	{
+		for( int i = 0; i < stages.size(); ++ i )
+		{
+			delete stages[i];
+		}
+		for( int i2 = 0; i2 < rings.size(); ++ i2 )
+		{
+			delete rings[i2];
+		}
+	}
+
+	// reads and prepares every program before any of them runs
+	bool load( const vector< string >& paths )
+	{
+		for( int i = 0; i < paths.size(); ++ i )
+		{
+			string byteCode;
+			if( !readProgram( paths[i], byteCode ) )
+			{
+				return false;
+			}
+			Stage* stage = new Stage;
+			stages.push_back( stage );
+			stage->path = paths[i];
+			Vm& vm = stage->vm;
+			vm.checked = checked;
+			vm.buildOps( byteCode );
+			if( !vm.buildLabels() )
+			{
+				cerr << paths[i] << ": label defined twice" << endl;
+				return false;
+			}
+			if( optimize )
+			{
+				Optimizer optimizer;
+				optimizer.run( vm );
+			}
+			if( memoize )
+			{
+				stage->memoizer.run( vm );
+			}
+			if( registers )
+			{
+				vm.buildIr();
+			}
+		}
+
+		for( int i2 = 0; i2 < stages.size(); ++ i2 )
+		{
+			RingIo& io = stages[i2]->io;
+			io.vm = &stages[i2]->vm;
+			io.vm->io = &io;
+			if( i2 > 0 )
+			{
+				io.in = rings.back();
+			}
+			if( i2 + 1 < stages.size() )
+			{
+				rings.push_back( new Ring );
+				io.out = rings.back();
+			}
+		}
+		return true;
+	}
+
+	// runs all of them, returns the status of the last one
+	int run()
+	{
+		cout.flush();
+		for( int i = 0; i < stages.size(); ++ i )
+		{
+			Stage* stage = stages[i];
+#ifdef WIN32
+			DWORD id;
+			stage->thread = CreateThread( NULL, 0, runStage, stage, 0, &id );
+#else
+			pthread_create( &stage->thread, NULL, runStage, stage );
+#endif
+		}
+		for( int i2 = 0; i2 < stages.size(); ++ i2 )
+		{
+#ifdef WIN32
+			WaitForSingleObject( stages[i2]->thread, INFINITE );
+			CloseHandle( stages[i2]->thread );
+#else
+			pthread_join( stages[i2]->thread, NULL );
+#endif
+		}
+		cout.flush();
+		return stages.size() ? Limits::statusOf( stages.back()->vm.error ) : statusOk;
+	}
+
+protected:
+#ifdef WIN32
+	static DWORD WINAPI runStage( LPVOID p )
+#else
+	static void* runStage( void* p )
+#endif
+	{
+		Stage* stage = (Stage*) p;
+		stage->vm.run();
+		stage->io.flush();
+		if( stage->io.out )
+		{
+			stage->io.out->close();
+		}
+		if( stage->io.in )
+		{
+			stage->io.in->abandon();
+		}
+		return 0;
+	}
+};
@@ -0,0 +1,629 @@
+// value ranges, to leave out the overflow checks of -c where they can not fire
+//
+// The analysis runs over the CFG.  At the start of every block it knows the
+// ranges of the values on top of the stack and of the heap cells with a
+// constant address.  Inside a block it also remembers which values are the
+// same as another value or a heap cell, give or take a constant, so the test
+// of a jumpz or jumpn narrows the counter it was computed from on both ways
+// out.  Loops are widened to the next constant of the program, which is
+// where their counters usually stop.
+//
+// A call goes on at its target only, and every ret goes on at the op after
+// every call, so what a subroutine does to the heap is seen by its callers.
+// Checked arithmetic stops the program when it overflows, so every value
+// that goes on is an int.
+
+class Range
+{
+public:
+	double lo;
+	double hi;
+
+	Range()
+		:lo( INT_MIN ),
+		hi( INT_MAX )
+	{
+	}
+
+	Range( double _lo, double _hi )
+		:lo( _lo ),
+		hi( _hi )
+	{
+	}
+
+	bool empty()
+	{
+		return lo > hi;
+	}
+
+	bool isInt()
+	{
+		return lo >= INT_MIN && hi <= INT_MAX;
+	}
+
+	bool operator==( const Range& other ) const
+	{
+		return lo == other.lo && hi == other.hi;
+	}
+
+	Range join( const Range& other ) const
+	{
+		return Range( __min( lo, other.lo ), __max( hi, other.hi ) );
+	}
+
+	Range meet( const Range& other ) const
+	{
+		return Range( __max( lo, other.lo ), __min( hi, other.hi ) );
+	}
+
+	Range shift( double by ) const
+	{
+		return Range( lo + by, hi + by );
+	}
+
+	// what a checked op lets through
+	Range clip() const
+	{
+		return meet( Range() );
+	}
+};
+
+// a value on the stack inside a block, it is base( id ) + offset
+class RangeValue
+{
+public:
+	Range r;
+	int id;
+	int offset;
+};
+
+class RangeState
+{
+public:
+	bool reached;
+	int visits;
+	vector< Range > stack;	// top last, what is below is not known
+	map< int, Range > heap;	// cells not in here are not known
+
+	RangeState()
+		:reached( false ),
+		visits( 0 )
+	{
+	}
+
+	bool operator==( const RangeState& other ) const
+	{
+		return reached == other.reached && stack == other.stack && heap == other.heap;
+	}
+};
+
+class RangeAnalysis
+{
+public:
+	vector< bool > safe;	// of every op, true if it can not overflow
+	int arithmeticOps;	// that could overflow
+	int provenOps;	// of those, the ones that can not
+
+protected:
+	Vm& vm;
+	Cfg cfg;
+	vector< RangeState > in;	// of every block
+	vector< int > returnPoints;	// blocks after a call
+	vector< double > thresholds;	// the constants of the program, sorted
+
+	// the block that runs
+	vector< RangeValue > stack;
+	map< int, Range > heap;
+	map< int, pair< int, int > > cellOf;	// id -> cell, heap[cell] = base( id ) + offset
+	int ids;
+	bool marking;
+
+public:
+	RangeAnalysis( Vm& _vm )
+		:arithmeticOps( 0 ),
+		provenOps( 0 ),
+		vm( _vm ),
+		cfg( _vm ),
+		ids( 0 ),
+		marking( false )
+	{
+		safe.assign( vm.ops.size(), false );
+		analyse();
+	}
+
+protected:
+	enum
+	{
+		maxStack = 64,	// values kept at the start of a block
+		widenAfter = 3,	// visits of a block
+		maxRounds = 1000
+	};
+
+	void analyse()
+	{
+		if( cfg.blocks.size() == 0 )
+		{
+			return;
+		}
+
+		thresholds.push_back( INT_MIN );
+		thresholds.push_back( INT_MAX );
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			if( op->getCode() == opPush )
+			{
+				double v = ( (OpPush*) op )->value;
+				thresholds.push_back( v - 1 );
+				thresholds.push_back( v );
+				thresholds.push_back( v + 1 );
+			}
+			else if( ( op->getCode() == opCall || op->getCode() == opCallMemo ) && i + 1 < vm.ops.size() )
+			{
+				returnPoints.push_back( cfg.blockOf[i + 1] );
+			}
+		}
+		sort( thresholds.begin(), thresholds.end() );
+
+		in.resize( cfg.blocks.size() );
+		in[0].reached = true;
+
+		bool changed = true;
+		for( int round = 0; changed && round < maxRounds; ++ round )
+		{
+			changed = false;
+			for( int b = 0; b < cfg.blocks.size(); ++ b )
+			{
+				if( in[b].reached )
+				{
+					changed = run( b ) || changed;
+				}
+			}
+		}
+
+		// the ranges hold for every run now, mark what they prove, unless
+		// there were too many rounds to get there
+		marking = !changed;
+		for( int b2 = 0; b2 < cfg.blocks.size(); ++ b2 )
+		{
+			if( marking && in[b2].reached )
+			{
+				run( b2 );
+			}
+		}
+		for( int i2 = 0; i2 < vm.ops.size(); ++ i2 )
+		{
+			int code = vm.ops[i2]->getCode();
+			if( code == opAdd || code == opSub || code == opMul || code == opDiv || code == opMod )
+			{
+				++ arithmeticOps;
+				if( marking && !in[ cfg.blockOf[i2] ].reached )
+				{
+					// never runs
+					safe[i2] = true;
+				}
+				if( safe[i2] )
+				{
+					++ provenOps;
+				}
+			}
+		}
+	}
+
+	// runs block b from its state, true if a successor changed
+	bool run( int b )
+	{
+		Block& block = cfg.blocks[b];
+		RangeState& state = in[b];
+
+		stack.clear();
+		cellOf.clear();
+		for( int i = 0; i < state.stack.size(); ++ i )
+		{
+			stack.push_back( fresh( state.stack[i] ) );
+		}
+		heap = state.heap;
+
+		bool changed = false;
+		for( int i2 = block.first; i2 < block.last; ++ i2 )
+		{
+			Op* op = vm.ops[i2];
+			int code = op->getCode();
+			switch( code )
+			{
+			case opJumpZ:
+			case opJumpN:
+				{
+					RangeValue v = pop();
+					int target = vm.labels[ ( (OpLabel*) op )->label ];
+					Range taken = ( code == opJumpZ ) ? Range( 0, 0 ) : Range( INT_MIN, -1 );
+					Range fall = ( code == opJumpZ ) ? notZero( v.r ) : Range( 0, INT_MAX );
+
+					vector< RangeValue > savedStack = stack;
+					map< int, Range > savedHeap = heap;
+					if( target < vm.ops.size() && refine( v, taken ) )
+					{
+						changed = flow( cfg.blockOf[target] ) || changed;
+					}
+					stack = savedStack;
+					heap = savedHeap;
+					if( block.last < vm.ops.size() && refine( v, fall ) )
+					{
+						changed = flow( b + 1 ) || changed;
+					}
+					return changed;
+				}
+			case opJump:
+			case opCall:
+			case opCallMemo:
+				// a memoized call that hits comes back with what a ret
+				// brought there before
+				{
+					int target = vm.labels[ ( (OpLabel*) op )->label ];
+					if( target < vm.ops.size() )
+					{
+						changed = flow( cfg.blockOf[target] );
+					}
+					return changed;
+				}
+			case opRet:
+				for( int i3 = 0; i3 < returnPoints.size(); ++ i3 )
+				{
+					changed = flow( returnPoints[i3] ) || changed;
+				}
+				return changed;
+			case opExit:
+				return false;
+			case opOther:
+				// could do anything
+				stack.clear();
+				heap.clear();
+				cellOf.clear();
+				break;
+			default:
+				step( i2, op );
+				break;
+			}
+		}
+
+		if( block.last < vm.ops.size() )
+		{
+			changed = flow( b + 1 );
+		}
+		return changed;
+	}
+
+	void step( int i, Op* op )
+	{
+		RangeValue a, b;
+		switch( op->getCode() )
+		{
+		case opPush:
+			{
+				double v = ( (OpPush*) op )->value;
+				stack.push_back( fresh( Range( v, v ) ) );
+			}
+			break;
+		case opPop:
+			pop();
+			break;
+		case opDoub:
+			a = pop();
+			stack.push_back( a );
+			stack.push_back( a );
+			break;
+		case opSwap:
+			b = pop();
+			a = pop();
+			stack.push_back( b );
+			stack.push_back( a );
+			break;
+		case opAdd:
+		case opSub:
+		case opMul:
+		case opDiv:
+		case opMod:
+			b = pop();
+			a = pop();
+			stack.push_back( arithmetic( i, op->getCode(), a, b ) );
+			break;
+		case opStore:
+			b = pop();
+			a = pop();
+			store( a.r, b );
+			break;
+		case opRetrive:
+			a = pop();
+			stack.push_back( retrive( a.r ) );
+			break;
+		case opInC:
+			a = pop();
+			// a char, whatever its sign
+			store( a.r, fresh( Range( -128, 255 ) ) );
+			break;
+		case opInN:
+			a = pop();
+			store( a.r, fresh( Range() ) );
+			break;
+		case opOutC:
+		case opOutN:
+			pop();
+			break;
+		}
+	}
+
+	RangeValue arithmetic( int i, int code, RangeValue& a, RangeValue& b )
+	{
+		Range r;
+		bool fails = false;	// by a zero divisor or int_min / -1
+		switch( code )
+		{
+		case opAdd:
+			r = Range( a.r.lo + b.r.lo, a.r.hi + b.r.hi );
+			break;
+		case opSub:
+			r = Range( a.r.lo - b.r.hi, a.r.hi - b.r.lo );
+			break;
+		case opMul:
+			{
+				double p[4] = { a.r.lo * b.r.lo, a.r.lo * b.r.hi, a.r.hi * b.r.lo, a.r.hi * b.r.hi };
+				r = Range( p[0], p[0] );
+				for( int k = 1; k < 4; ++ k )
+				{
+					r = r.join( Range( p[k], p[k] ) );
+				}
+			}
+			break;
+		case opDiv:
+		case opMod:
+			fails = ( b.r.lo <= 0 && b.r.hi >= 0 ) ||
+				( a.r.lo == INT_MIN && b.r.lo <= -1 && b.r.hi >= -1 );
+			if( code == opDiv )
+			{
+				// never further from 0 than a
+				double m = __max( -a.r.lo, a.r.hi );
+				r = Range( -m, m );
+			}
+			else
+			{
+				// the sign of a, closer to 0 than b
+				double m = __max( -b.r.lo, b.r.hi ) - 1;
+				r = Range( __min( a.r.lo, 0.0 ), __max( a.r.hi, 0.0 ) ).meet( Range( -m, m ) );
+			}
+			break;
+		}
+
+		if( marking && !fails && r.isInt() )
+		{
+			safe[i] = true;
+		}
+
+		RangeValue v;
+		if( b.r.lo == b.r.hi && ( code == opAdd || code == opSub ) && r.isInt() )
+		{
+			// still the same counter
+			v = a;
+			v.offset += (int) ( code == opAdd ? b.r.lo : -b.r.lo );
+			v.r = r;
+			return v;
+		}
+		return fresh( r.clip() );
+	}
+
+	void store( Range address, RangeValue v )
+	{
+		if( address.lo == address.hi )
+		{
+			int cell = (int) address.lo;
+			forget( cell );
+			heap[cell] = v.r;
+			cellOf[v.id] = make_pair( cell, v.offset );
+			return;
+		}
+
+		// could be any cell in the range, they keep their value or get v
+		map< int, Range >::iterator it = heap.begin();
+		while( it != heap.end() )
+		{
+			if( it->first >= address.lo && it->first <= address.hi )
+			{
+				forget( it->first );
+				it->second = it->second.join( v.r );
+			}
+			++ it;
+		}
+	}
+
+	RangeValue retrive( Range address )
+	{
+		if( address.lo != address.hi )
+		{
+			return fresh( Range() );
+		}
+
+		int cell = (int) address.lo;
+		map< int, pair< int, int > >::iterator it;
+		for( it = cellOf.begin(); it != cellOf.end(); ++ it )
+		{
+			if( it->second.first == cell )
+			{
+				RangeValue v;
+				v.id = it->first;
+				v.offset = it->second.second;
+				v.r = heap[cell];
+				return v;
+			}
+		}
+
+		map< int, Range >::iterator known = heap.find( cell );
+		RangeValue v = fresh( known != heap.end() ? known->second : Range() );
+		heap[cell] = v.r;
+		cellOf[v.id] = make_pair( cell, 0 );
+		return v;
+	}
+
+	// cell gets a new value, the values that were loaded from it do not change
+	void forget( int cell )
+	{
+		map< int, pair< int, int > >::iterator it = cellOf.begin();
+		while( it != cellOf.end() )
+		{
+			if( it->second.first == cell )
+			{
+				cellOf.erase( it++ );
+			}
+			else
+			{
+				++ it;
+			}
+		}
+	}
+
+	// v is known to be in r: so is everything that is the same as v, false
+	// if that can not be
+	bool refine( RangeValue v, Range r )
+	{
+		Range base = v.r.meet( r ).shift( -v.offset );
+		if( base.empty() )
+		{
+			return false;
+		}
+		for( int i = 0; i < stack.size(); ++ i )
+		{
+			if( stack[i].id == v.id )
+			{
+				stack[i].r = stack[i].r.meet( base.shift( stack[i].offset ) );
+			}
+		}
+		map< int, pair< int, int > >::iterator it = cellOf.find( v.id );
+		if( it != cellOf.end() )
+		{
+			Range& cell = heap[ it->second.first ];
+			cell = cell.meet( base.shift( it->second.second ) );
+		}
+		return true;
+	}
+
+	// r without 0, which a range can only lose at its ends
+	static Range notZero( Range r )
+	{
+		if( r.lo == 0 )
+		{
+			r.lo = 1;
+		}
+		if( r.hi == 0 )
+		{
+			r.hi = -1;
+		}
+		return r;
+	}
+
+	// hands the state at the end of the block on to block b
+	bool flow( int b )
+	{
+		if( marking )
+		{
+			return false;
+		}
+
+		RangeState out;
+		out.reached = true;
+		int first = __max( 0, (int) stack.size() - maxStack );
+		for( int i = first; i < stack.size(); ++ i )
+		{
+			out.stack.push_back( stack[i].r );
+		}
+		out.heap = heap;
+
+		RangeState& target = in[b];
+		RangeState next = target.reached ? join( target, out ) : out;
+		if( target.reached && ++ target.visits > widenAfter )
+		{
+			next = widen( target, next );
+		}
+		next.visits = target.visits;
+		if( next == target )
+		{
+			return false;
+		}
+		target = next;
+		return true;
+	}
+
+	static RangeState join( RangeState& a, RangeState& b )
+	{
+		RangeState j;
+		j.reached = true;
+		int n = __min( a.stack.size(), b.stack.size() );
+		for( int i = 0; i < n; ++ i )
+		{
+			j.stack.push_back( a.stack[ a.stack.size() - n + i ].join( b.stack[ b.stack.size() - n + i ] ) );
+		}
+		map< int, Range >::iterator it;
+		for( it = a.heap.begin(); it != a.heap.end(); ++ it )
+		{
+			map< int, Range >::iterator other = b.heap.find( it->first );
+			if( other != b.heap.end() )
+			{
+				j.heap[it->first] = it->second.join( other->second );
+			}
+		}
+		return j;
+	}
+
+	// next only got bigger than old, let what grew go to the next threshold
+	RangeState widen( RangeState& old, RangeState& next )
+	{
+		RangeState w = next;
+		int n = __min( old.stack.size(), w.stack.size() );
+		for( int i = 0; i < n; ++ i )
+		{
+			w.stack[ w.stack.size() - n + i ] = widen( old.stack[ old.stack.size() - n + i ], w.stack[ w.stack.size() - n + i ] );
+		}
+		map< int, Range >::iterator it;
+		for( it = w.heap.begin(); it != w.heap.end(); ++ it )
+		{
+			map< int, Range >::iterator o = old.heap.find( it->first );
+			if( o != old.heap.end() )
+			{
+				it->second = widen( o->second, it->second );
+			}
+		}
+		return w;
+	}
+
+	Range widen( Range old, Range next )
+	{
+		if( next.lo < old.lo )
+		{
+			vector< double >::iterator t = upper_bound( thresholds.begin(), thresholds.end(), next.lo );
+			next.lo = ( t == thresholds.begin() ) ? INT_MIN : *( t - 1 );
+		}
+		if( next.hi > old.hi )
+		{
+			vector< double >::iterator t = lower_bound( thresholds.begin(), thresholds.end(), next.hi );
+			next.hi = ( t == thresholds.end() ) ? INT_MAX : *t;
+		}
+		return next;
+	}
+
+	RangeValue fresh( Range r )
+	{
+		RangeValue v;
+		v.r = r;
+		v.id = ids ++;
+		v.offset = 0;
+		return v;
+	}
+
+	RangeValue pop()
+	{
+		if( stack.empty() )
+		{
+			return fresh( Range() );
+		}
+		RangeValue v = stack.back();
+		stack.pop_back();
+		return v;
+	}
+};
@@ -0,0 +1,356 @@
+// hosts many programs on one thread
+//
+// Every Session runs its Vm on a BufferIo.  When the program waits for input
+// or its output is backing up the Vm suspends, and epoll tells the Reactor
+// when the file descriptors are ready again.  Input is only read ahead up to
+// the high water mark of the BufferIo, so a fast writer can not fill memory.
+// Runnable sessions get a slice of instructions each, so a busy program can
+// not starve the others.
+
+#ifndef WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <deque>
+
+class Session;
+
+class Watch
+{
+public:
+	Session* session;
+	int fd;
+	unsigned events;
+	bool polled;	// false for files epoll can not watch, they are always ready
+	int flags;
+};
+
+class Session
+{
+public:
+	Vm* vm;
+	BufferIo io;
+	Watch in;
+	Watch out;
+	bool queued;
+	bool dead;
+
+	Session( Vm* _vm, int inFd, int outFd )
+		:vm( _vm ),
+		queued( false ),
+		dead( false )
+	{
+		in.session = this;
+		in.fd = inFd;
+		in.events = 0;
+		in.polled = false;
+		out.session = this;
+		out.fd = outFd;
+		out.events = 0;
+		out.polled = false;
+	}
+
+	virtual ~Session()
+	{
+	}
+
+	// the program has ended, its output may still be on the way
+	virtual void ended()
+	{
+	}
+
+	// the program has ended and all of its output is written
+	virtual void finish( class Reactor& reactor )
+	{
+	}
+
+	bool sharedFd()
+	{
+		return in.fd == out.fd;
+	}
+};
+
+class Reactor
+{
+public:
+	int epfd;
+	int slice;
+	int sessions;
+	deque< Session* > ready;
+
+	Reactor()
+		:epfd( epoll_create( 64 ) ),
+		slice( 10000 ),
+		sessions( 0 )
+	{
+		assert( epfd >= 0 );
+		signal( SIGPIPE, SIG_IGN );
+	}
+
+	virtual ~Reactor()
+	{
+		close( epfd );
+	}
+
+	// the vm must be reset, it starts running with the next loop
+	void add( Session* s )
+	{
+		s->vm->io = &s->io;
+		++ sessions;
+
+		open( s->in );
+		if( !s->sharedFd() )
+		{
+			open( s->out );
+		}
+		interest( s->in, EPOLLIN );
+		schedule( s );
+	}
+
+	void loop()
+	{
+		while( alive() )
+		{
+			step( -1 );
+		}
+	}
+
+	// the loop ends when this turns false
+	virtual bool alive()
+	{
+		return sessions > 0;
+	}
+
+	// runs the ready sessions once and handles the events that came in,
+	// waits at most timeout ms (-1 forever) if nothing is ready
+	void step( int timeout )
+	{
+		int count = ready.size();
+		for( int i = 0; i < count; ++ i )
+		{
+			Session* s = ready.front();
+			ready.pop_front();
+			s->queued = false;
+			runSlice( s );
+		}
+		if( !alive() )
+		{
+			return;
+		}
+
+		epoll_event events[64];
+		int n = epoll_wait( epfd, events, 64, ready.empty() ? timeout : 0 );
+		for( int i2 = 0; i2 < n; ++ i2 )
+		{
+			handle( (Watch*) events[i2].data.ptr, events[i2].events );
+		}
+	}
+
+	virtual void handle( Watch* w, unsigned events )
+	{
+		Session* s = w->session;
+		if( events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )
+		{
+			if( w == &s->in && s->io.buffered() < s->io.highWater )
+			{
+				readInput( s );
+			}
+		}
+		if( events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+		{
+			writeOutput( s );
+		}
+		update( s );
+	}
+
+protected:
+	void open( Watch& w )
+	{
+		w.flags = fcntl( w.fd, F_GETFL );
+		fcntl( w.fd, F_SETFL, w.flags | O_NONBLOCK );
+
+		epoll_event e;
+		e.events = 0;
+		e.data.ptr = &w;
+		w.polled = ( epoll_ctl( epfd, EPOLL_CTL_ADD, w.fd, &e ) == 0 );
+		w.events = 0;
+	}
+
+	void shut( Watch& w )
+	{
+		if( w.polled )
+		{
+			epoll_ctl( epfd, EPOLL_CTL_DEL, w.fd, NULL );
+			w.polled = false;
+		}
+		fcntl( w.fd, F_SETFL, w.flags );
+	}
+
+	// sets the events of the fd that belongs to interest, in and out are
+	// the same watch when the session talks over one socket
+	void interest( Watch& w, unsigned events )
+	{
+		Session* s = w.session;
+		Watch& target = s->sharedFd() ? s->in : w;
+		unsigned all = events;
+		if( s->sharedFd() )
+		{
+			unsigned other = ( &w == &s->in ) ? EPOLLOUT : EPOLLIN;
+			all = ( target.events & other ) | events;
+		}
+		if( target.polled && all != target.events )
+		{
+			epoll_event e;
+			e.events = all;
+			e.data.ptr = &target;
+			epoll_ctl( epfd, EPOLL_CTL_MOD, target.fd, &e );
+		}
+		target.events = all;
+	}
+
+	void schedule( Session* s )
+	{
+		if( !s->queued )
+		{
+			s->queued = true;
+			ready.push_back( s );
+		}
+	}
+
+	void runSlice( Session* s )
+	{
+		if( !s->dead && !s->vm->finished() && !waitsForInput( s ) && !backedUp( s ) )
+		{
+			s->vm->resume( slice );
+			if( s->vm->finished() )
+			{
+				s->ended();
+			}
+		}
+		writeOutput( s );
+		update( s );
+	}
+
+	bool waitsForInput( Session* s )
+	{
+		BufferIo& io = s->io;
+		return s->vm->blocked && io.starved && !io.inEof;
+	}
+
+	bool backedUp( Session* s )
+	{
+		return s->io.pending() >= s->io.highWater;
+	}
+
+	// decides what the session waits for next
+	void update( Session* s )
+	{
+		if( s->dead || ( s->vm->finished() && s->io.pending() == 0 ) )
+		{
+			remove( s );
+			return;
+		}
+
+		interest( s->out, s->io.pending() > 0 ? (unsigned) EPOLLOUT : 0 );
+		if( !s->io.inEof )
+		{
+			// input that piles up is not read further, like output
+			interest( s->in, s->io.buffered() < s->io.highWater ? (unsigned) EPOLLIN : 0 );
+		}
+
+		if( s->vm->finished() )
+		{
+			if( !s->out.polled && !s->sharedFd() )
+			{
+				schedule( s );
+			}
+			return;
+		}
+
+		if( waitsForInput( s ) )
+		{
+			if( !s->in.polled )
+			{
+				// plain files can always be read
+				readInput( s );
+				schedule( s );
+			}
+		}
+		else if( !backedUp( s ) || !s->out.polled )
+		{
+			schedule( s );
+		}
+	}
+
+	void readInput( Session* s )
+	{
+		char buffer[16 * 1024];
+		int n;
+		while( ( n = read( s->in.fd, buffer, sizeof( buffer ) ) ) < 0 && errno == EINTR )
+		{
+		}
+		if( n > 0 )
+		{
+			s->io.feed( buffer, n );
+		}
+		else if( n == 0 || errno != EAGAIN )
+		{
+			s->io.inEof = true;
+			if( s->sharedFd() )
+			{
+				interest( s->in, 0 );
+			}
+			else if( s->in.polled )
+			{
+				// a closed pipe would report EPOLLHUP forever
+				epoll_ctl( epfd, EPOLL_CTL_DEL, s->in.fd, NULL );
+				s->in.polled = false;
+			}
+		}
+	}
+
+	void writeOutput( Session* s )
+	{
+		BufferIo& io = s->io;
+		while( io.pending() > 0 )
+		{
+			int n = write( s->out.fd, io.out.data() + io.outPos, io.pending() );
+			if( n > 0 )
+			{
+				io.consumed( n );
+			}
+			else
+			{
+				if( errno != EAGAIN && errno != EINTR )
+				{
+					// nobody listens anymore
+					s->dead = true;
+				}
+				return;
+			}
+		}
+	}
+
+	void remove( Session* s )
+	{
+		if( s->queued )
+		{
+			ready.erase( find( ready.begin(), ready.end(), s ) );
+			s->queued = false;
+		}
+		shut( s->in );
+		if( !s->sharedFd() )
+		{
+			shut( s->out );
+		}
+		-- sessions;
+		s->finish( *this );
+	}
+};
+
+#endif
@@ -0,0 +1,228 @@
+// input that is written down once and read back later, with -R and -P
+//
+//	wsinter prog.ws -R prog.log	runs on cin and writes every inc and inn to prog.log
+//	wsinter prog.ws -P prog.log	runs with the input from prog.log, cin is not read
+//
+// The log is text, one read a line: c or n, the instructions the program had
+// used up to the read and the value, -1 for the end of input of an inc.  The
+// count comes from the Metrics with -M, else the Limits charge the blocks for
+// it, so it is of ops after -O and takes the whole block of the read.  A
+// replay reads the log before the program starts, its reads then only take
+// the next entry.  A program that wants other input than the log has, or
+// more of it, did not run the recorded workload; replay then says so.
+
+#define REPLAY_MAGIC "wsr1"
+
+struct ReplayInput
+{
+	char kind;	// 'c' or 'n'
+	double count;
+	int value;
+};
+
+class RecordIo: public Io
+{
+public:
+	Io* inner;
+	Vm* vm;
+	ofstream out;
+	int reads;
+
+	RecordIo()
+		:inner( NULL ),
+		vm( NULL ),
+		reads( 0 )
+	{
+	}
+
+	bool open( const char* path )
+	{
+		out.open( path, ios::out | ios::binary );
+		out << REPLAY_MAGIC << "\n";
+		return out.good();
+	}
+
+	// after the Vm got its io, before the Metrics
+	void attach( Vm& _vm )
+	{
+		vm = &_vm;
+		inner = vm->io;
+		vm->io = this;
+	}
+
+	virtual bool getChar( int& ch )
+	{
+		if( !inner->getChar( ch ) )
+		{
+			return false;
+		}
+		add( 'c', ch );
+		return true;
+	}
+
+	virtual bool getNumber( int& v )
+	{
+		if( !inner->getNumber( v ) )
+		{
+			return false;
+		}
+		add( 'n', v );
+		return true;
+	}
+
+	virtual bool write( const char* p, int n )
+	{
+		return inner->write( p, n );
+	}
+
+	virtual bool putChar( char ch )
+	{
+		return inner->putChar( ch );
+	}
+
+	virtual bool putNumber( int v )
+	{
+		return inner->putNumber( v );
+	}
+
+	virtual void error( const char* p, int n )
+	{
+		inner->error( p, n );
+	}
+
+	virtual void flush()
+	{
+		inner->flush();
+		out.flush();
+	}
+
+protected:
+	void add( char kind, int v )
+	{
+		char buffer[64];
+		sprintf( buffer, "%c %.0f %d\n", kind, instructions(), v );
+		out << buffer;
+		++ reads;
+	}
+
+	double instructions();
+};
+
+class ReplayIo: public Io
+{
+public:
+	Io* inner;	// the output still goes there
+	vector< ReplayInput > inputs;
+	int next;
+	int missing;	// reads the log had nothing for
+	int mismatched;	// reads that found the other kind
+
+	ReplayIo()
+		:inner( NULL ),
+		next( 0 ),
+		missing( 0 ),
+		mismatched( 0 )
+	{
+	}
+
+	bool load( const char* path )
+	{
+		ifstream in( path, ios::in | ios::binary );
+		string magic;
+		if( !( in >> magic ) || magic != REPLAY_MAGIC )
+		{
+			return false;
+		}
+		ReplayInput input;
+		string kind;
+		while( in >> kind >> input.count >> input.value )
+		{
+			if( kind != "c" && kind != "n" )
+			{
+				return false;
+			}
+			input.kind = kind[0];
+			inputs.push_back( input );
+		}
+		return in.eof();
+	}
+
+	void attach( Vm& vm )
+	{
+		inner = vm.io;
+		vm.io = this;
+	}
+
+	// true if the run read what the log has, no more and no less
+	bool same()
+	{
+		return !missing && !mismatched && next == inputs.size();
+	}
+
+	virtual bool getChar( int& ch )
+	{
+		ch = take( 'c', -1 );
+		return true;
+	}
+
+	virtual bool getNumber( int& v )
+	{
+		v = take( 'n', 0 );
+		return true;
+	}
+
+	virtual bool write( const char* p, int n )
+	{
+		return inner->write( p, n );
+	}
+
+	virtual bool putChar( char ch )
+	{
+		return inner->putChar( ch );
+	}
+
+	virtual bool putNumber( int v )
+	{
+		return inner->putNumber( v );
+	}
+
+	virtual void error( const char* p, int n )
+	{
+		inner->error( p, n );
+	}
+
+	virtual void flush()
+	{
+		inner->flush();
+	}
+
+protected:
+	// the end of input once the log is used up
+	int take( char kind, int end )
+	{
+		if( next == inputs.size() )
+		{
+			++ missing;
+			return end;
+		}
+		ReplayInput& input = inputs[next ++];
+		if( input.kind != kind )
+		{
+			++ mismatched;
+		}
+		return input.value;
+	}
+};
+
+double RecordIo::instructions()
+{
+	if( vm->metrics )
+	{
+		return vm->metrics->instructions();
+	}
+	if( vm->limits )
+	{
+		return vm->limits->used( *vm );
+	}
+	return 0;
+}
@@ -0,0 +1,205 @@
+// what the ops mean, shared by Ops.h and the compile time Vm of Constexpr.h
+//
+// The byte code is the one of toByteCode(), a for a space, b for a tab and c
+// for a line feed.  Everything here is plain C++ for the interpreter and
+// constexpr where the compiler knows C++14, so both read and run a program
+// the same way.  The run functions take any stack with size(), operator[],
+// pop_back() and back().  Arithmetic wraps around, in unsigned to keep the
+// compiler from calling an overflow undefined.
+
+#if __cplusplus >= 201402L || ( defined( _MSVC_LANG ) && _MSVC_LANG >= 201402L )
+#define WS_CONSTEXPR constexpr
+#else
+#define WS_CONSTEXPR inline
+#endif
+
+// what an op does, for the passes that look at the whole program
+enum OpCode
+{
+	opOther,
+	opPush,
+	opPop,
+	opLabel,
+	opDoub,
+	opSwap,
+	opAdd,
+	opSub,
+	opMul,
+	opDiv,
+	opMod,
+	opStore,
+	opRetrive,
+	opCall,
+	opJump,
+	opJumpZ,
+	opJumpN,
+	opRet,
+	opExit,
+	opOutC,
+	opOutN,
+	opInC,
+	opInN,
+	opOutS,		// made by the optimizer, not read
+	opCallMemo,	// made by the Memoizer
+	opMemoSave,
+	opCharge,	// made by Limits
+	opCount		// made by a Profile that is collected
+};
+
+// by OpCode, for what prints counts of ops
+static const char* const opCodeNames[] =
+{
+	"other", "push", "pop", "label", "doub", "swap", "add", "sub", "mul", "div",
+	"mod", "store", "retrive", "call", "jump", "jumpz", "jumpn", "ret", "exit", "outc",
+	"outn", "inc", "inn", "outs", "call memo", "memo save", "charge",
+	"count"
+};
+
+#define SIGNATURE_PUSH "aa"
+#define SIGNATURE_POP "acc"
+#define SIGNATURE_LABEL "caa"
+#define SIGNATURE_DOUB "aca"
+#define SIGNATURE_SWAP "acb"
+#define SIGNATURE_ADD "baaa"
+#define SIGNATURE_SUB "baab"
+#define SIGNATURE_MUL "baac"
+#define SIGNATURE_DIV "baba"
+#define SIGNATURE_MOD "babb"
+#define SIGNATURE_STORE "bba"
+#define SIGNATURE_RETRIVE "bbb"
+#define SIGNATURE_CALL "cab"
+#define SIGNATURE_JUMP "cac"
+#define SIGNATURE_JUMPZ "cba"
+#define SIGNATURE_JUMPN "cbb"
+#define SIGNATURE_RET "cbc"
+#define SIGNATURE_EXIT "ccc"
+#define SIGNATURE_OUTC "bcaa"
+#define SIGNATURE_OUTN "bcab"
+#define SIGNATURE_INC "bcba"
+#define SIGNATURE_INN "bcbb"
+#define SIGNATURE_DEBUG_PRINT_STACK "ccaaa"
+#define SIGNATURE_DEBUG_PRINT_HEAP "ccaab"
+
+// the number behind a push: a sign (a is +, b is -) and binary digits up to
+// a c, length is what it took or -1 if the byte code ends before the c
+WS_CONSTEXPR int parseNumber( const char* s, int n, int& length )
+{
+	if( n == 0 )
+	{
+		length = -1;
+		return 0;
+	}
+
+	int i = 0;
+	int sign = 1;
+	int value = 0;
+	if( s[0] == 'a' )
+	{
+		++ i;
+	}
+	else if( s[0] == 'b' )
+	{
+		sign = -1;
+		++ i;
+	}
+
+	while( ( i < n ) && ( s[i] != 'c' ) )
+	{
+		value = 2 * value + ( s[i] == 'b' ? 1 : 0 );
+		++ i;
+	}
+
+	++ i;
+	length = ( i <= n ) ? i : -1;
+	return sign * value;
+}
+
+// the bits of a label up to its c, returns how many there are
+WS_CONSTEXPR int parseLabel( const char* s, int n, int& length )
+{
+	if( n == 0 )
+	{
+		length = -1;
+		return 0;
+	}
+
+	int i = 0;
+	while( ( i < n ) && ( s[i] != 'c' ) )
+	{
+		++ i;
+	}
+
+	length = ( i + 1 <= n ) ? i + 1 : -1;
+	return i;
+}
+
+WS_CONSTEXPR int wrapAdd( int a, int b )
+{
+	return (int) ( (unsigned) a + (unsigned) b );
+}
+
+WS_CONSTEXPR int wrapSub( int a, int b )
+{
+	return (int) ( (unsigned) a - (unsigned) b );
+}
+
+WS_CONSTEXPR int wrapMul( int a, int b )
+{
+	return (int) ( (unsigned) a * (unsigned) b );
+}
+
+// b is not 0, that is for the caller to catch
+WS_CONSTEXPR int wrapDiv( int a, int b )
+{
+	return ( b == -1 ) ? wrapSub( 0, a ) : a / b;
+}
+
+WS_CONSTEXPR int wrapMod( int a, int b )
+{
+	return ( b == -1 ) ? 0 : a % b;
+}
+
+template< class S >
+WS_CONSTEXPR void runAdd( S& stack )
+{
+	int size = stack.size();
+	int i = wrapAdd( stack[ size - 2 ], stack[ size - 1 ] );
+	stack.pop_back();
+	stack.back() = i;
+}
+
+template< class S >
+WS_CONSTEXPR void runSub( S& stack )
+{
+	int size = stack.size();
+	int i = wrapSub( stack[ size - 2 ], stack[ size - 1 ] );
+	stack.pop_back();
+	stack.back() = i;
+}
+
+template< class S >
+WS_CONSTEXPR void runMul( S& stack )
+{
+	int size = stack.size();
+	int i = wrapMul( stack[ size - 2 ], stack[ size - 1 ] );
+	stack.pop_back();
+	stack.back() = i;
+}
+
+template< class S >
+WS_CONSTEXPR void runDiv( S& stack )
+{
+	int size = stack.size();
+	int i = wrapDiv( stack[ size - 2 ], stack[ size - 1 ] );
+	stack.pop_back();
+	stack.back() = i;
+}
+
+template< class S >
+WS_CONSTEXPR void runMod( S& stack )
+{
+	int size = stack.size();
+	int i = wrapMod( stack[ size - 2 ], stack[ size - 1 ] );
+	stack.pop_back();
+	stack.back() = i;
+}
@@ -0,0 +1,513 @@
+// wsinter --serve: a daemon that keeps parsed programs warm
+//
+// A client connects to the unix socket and sends
+//
+//   WSINTER <length> <flags> [<path>]\n<length bytes of program><stdin ...>
+//
+// The program is what its file holds, in any format readProgram() takes; a
+// .wsa source comes with its path, its includes are read from next to it.
+// The cache reads those includes again on every hit and assembles the
+// source again when one of them changed.
+// flags is "d" for a debug trace, "s" for the status or "-" for neither.  The
+// server looks the program up by the hash of its source, takes an idle Vm for
+// it from the cache (parsing the program only on a miss), feeds it the rest of
+// the connection as stdin and streams the output back.  The connection is
+// closed when the program ends; with "s" the last WSINTER_STATUS_LENGTH bytes
+// before that are not output but "\0ws" and the exit status in four digits
+// and a newline, the status wsinter would have returned for the run.
+//
+// Every Vm the server hands out runs under the cache's Limits, a heap of
+// 256 MB and 10^10 instructions unless --serve is given other ones with -L,
+// so a program that runs away ends with a runtime error and not the server.
+//
+// A socket that a server still answers on is not taken over, only one that
+// is left over from a server that is gone.
+
+#ifndef WIN32
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define WSINTER_SOCKET "/tmp/wsinter.socket"
+#define WSINTER_STATUS_LENGTH 8
+
+// a vm with limits of its own, they count for one run at a time
+class ServedVm: public Vm
+{
+public:
+	Limits limits;
+};
+
+class ProgramCache
+{
+public:
+	class Entry
+	{
+	public:
+		unsigned hash;
+		string source;
+		string path;	// of a .wsa source, empty for the other formats
+		vector< string > includes;	// the files the source includes
+		unsigned includesHash;	// of what they held when it was assembled
+		int generation;	// counts the times the includes changed
+		vector< ServedVm* > idle;
+		int active;
+		int lastUse;
+	};
+
+	map< unsigned, Entry* > entries;
+	int maxPrograms;
+	int maxIdle;
+	int clock;
+	int hits;
+	int misses;
+	vector< string > errors;	// of the last program that did not assemble
+	vector< string > includes;	// of the last program that was loaded
+	Limits limits;	// what every vm gets
+
+	ProgramCache()
+		:maxPrograms( 64 ),
+		maxIdle( 8 ),
+		clock( 0 ),
+		hits( 0 ),
+		misses( 0 )
+	{
+		limits.heap = 256 * 1024 * 1024;
+		limits.instructions = 1e10;
+	}
+
+	~ProgramCache()
+	{
+		map< unsigned, Entry* >::iterator it;
+		for( it = entries.begin(); it != entries.end(); ++ it )
+		{
+			drop( it->second );
+		}
+	}
+
+	// fnv-1a
+	static unsigned hashOf( const string& source, unsigned h = 2166136261u )
+	{
+		for( int i = 0; i < source.length(); ++ i )
+		{
+			h = ( h ^ (unsigned char) source[i] ) * 16777619u;
+		}
+		return h;
+	}
+
+	// of the contents of files, one that can not be read counts as empty
+	static unsigned hashOfFiles( const vector< string >& files )
+	{
+		unsigned h = 2166136261u;
+		for( int i = 0; i < files.size(); ++ i )
+		{
+			string data;
+			Assembler::readFile( files[i], data );
+			h = hashOf( data, hashOf( files[i], h ) );
+		}
+		return h;
+	}
+
+	// NULL with the errors if the program does not assemble, generation
+	// goes back to release()
+	ServedVm* acquire( const string& source, const string& path, int& generation )
+	{
+		generation = -1;
+		unsigned hash = hashOf( source, hashOf( path ) );
+		Entry* e = NULL;
+		map< unsigned, Entry* >::iterator it = entries.find( hash );
+		if( it != entries.end() )
+		{
+			e = it->second;
+			if( e->source != source || e->path != path )
+			{
+				if( e->active > 0 )
+				{
+					// collides with a program that is running, do not cache
+					++ misses;
+					return load( source, path );
+				}
+				entries.erase( it );
+				drop( e );
+				e = NULL;
+			}
+		}
+		if( e == NULL )
+		{
+			evict();
+			e = new Entry;
+			e->hash = hash;
+			e->source = source;
+			e->path = path;
+			e->includesHash = 0;
+			e->generation = 0;
+			e->active = 0;
+			entries[hash] = e;
+		}
+		else if( e->includes.size() && hashOfFiles( e->includes ) != e->includesHash )
+		{
+			// what runs now goes away when it is released
+			++ e->generation;
+			for( int i = 0; i < e->idle.size(); ++ i )
+			{
+				delete e->idle[i];
+			}
+			e->idle.clear();
+		}
+
+		generation = e->generation;
+		e->lastUse = ++ clock;
+		++ e->active;
+		if( e->idle.size() )
+		{
+			++ hits;
+			ServedVm* vm = e->idle.back();
+			e->idle.pop_back();
+			vm->limits.restart( *vm );
+			return vm;
+		}
+		++ misses;
+		ServedVm* vm = load( source, path );
+		if( !vm )
+		{
+			-- e->active;
+			return NULL;
+		}
+		e->includes = includes;
+		e->includesHash = hashOfFiles( includes );
+		return vm;
+	}
+
+	void release( const string& source, const string& path, int generation, ServedVm* vm )
+	{
+		vm->reset();
+
+		map< unsigned, Entry* >::iterator it = entries.find( hashOf( source, hashOf( path ) ) );
+		if( it != entries.end() && it->second->source == source && it->second->path == path )
+		{
+			Entry* e = it->second;
+			-- e->active;
+			if( e->generation == generation && e->idle.size() < maxIdle )
+			{
+				e->idle.push_back( vm );
+				return;
+			}
+		}
+		delete vm;
+	}
+
+protected:
+	ServedVm* load( const string& source, const string& path )
+	{
+		string byteCode;
+		errors.clear();
+		if( !toProgram( source, path, !path.empty(), byteCode, errors, includes ) )
+		{
+			return NULL;
+		}
+		ServedVm* vm = new ServedVm;
+		vm->buildOps( byteCode );
+		if( !vm->buildLabels() )
+		{
+			errors.push_back( "label defined twice" );
+			delete vm;
+			return NULL;
+		}
+		vm->limits = limits;
+		vm->limits.apply( *vm );
+		return vm;
+	}
+
+	// makes room for one more program
+	void evict()
+	{
+		while( entries.size() >= maxPrograms )
+		{
+			map< unsigned, Entry* >::iterator oldest = entries.end();
+			map< unsigned, Entry* >::iterator it;
+			for( it = entries.begin(); it != entries.end(); ++ it )
+			{
+				if( it->second->active == 0 &&
+					( oldest == entries.end() || it->second->lastUse < oldest->second->lastUse ) )
+				{
+					oldest = it;
+				}
+			}
+			if( oldest == entries.end() )
+			{
+				return;
+			}
+			drop( oldest->second );
+			entries.erase( oldest );
+		}
+	}
+
+	void drop( Entry* e )
+	{
+		for( int i = 0; i < e->idle.size(); ++ i )
+		{
+			delete e->idle[i];
+		}
+		delete e;
+	}
+};
+
+// what goes behind the output for a client that asked for the status
+string statusTrailer( int status )
+{
+	char trailer[WSINTER_STATUS_LENGTH + 1];
+	trailer[0] = 0;
+	sprintf( trailer + 1, "ws%04d\n", status );
+	return string( trailer, WSINTER_STATUS_LENGTH );
+}
+
+// a connection whose program is running
+class Connection: public Session
+{
+public:
+	string source;
+	string path;
+	int generation;	// of the cache entry
+	bool status;	// the client wants the exit status behind the output
+	bool cached;	// false when the vm only carries the errors of a load
+
+	Connection( ServedVm* vm, int fd, const string& _source, const string& _path )
+		:Session( vm, fd, fd ),
+		source( _source ),
+		path( _path ),
+		generation( -1 ),
+		status( false ),
+		cached( true )
+	{
+	}
+
+	virtual void ended()
+	{
+		if( status )
+		{
+			string trailer = statusTrailer( Limits::statusOf( vm->error ) );
+			io.write( trailer.data(), trailer.length() );
+		}
+	}
+
+	virtual void finish( Reactor& reactor );
+};
+
+// a connection that is still sending its header and program
+class Pending
+{
+public:
+	Watch watch;
+	string data;
+};
+
+class Server: public Reactor
+{
+public:
+	Watch listener;
+	map< int, Pending* > pending;
+	ProgramCache cache;
+
+	Server()
+	{
+		listener.session = NULL;
+		listener.fd = -1;
+	}
+
+	virtual ~Server()
+	{
+		if( listener.fd >= 0 )
+		{
+			close( listener.fd );
+		}
+	}
+
+	bool listen( const char* path )
+	{
+		sockaddr_un address;
+		memset( &address, 0, sizeof( address ) );
+		address.sun_family = AF_UNIX;
+		if( strlen( path ) >= sizeof( address.sun_path ) )
+		{
+			return false;
+		}
+		strcpy( address.sun_path, path );
+
+		listener.fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( listener.fd < 0 )
+		{
+			return false;
+		}
+		if( connect( listener.fd, (sockaddr*) &address, sizeof( address ) ) == 0 )
+		{
+			// another server answers there
+			return false;
+		}
+		close( listener.fd );
+		listener.fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( listener.fd < 0 )
+		{
+			return false;
+		}
+		unlink( path );
+		if( bind( listener.fd, (sockaddr*) &address, sizeof( address ) ) != 0 ||
+			::listen( listener.fd, 64 ) != 0 )
+		{
+			return false;
+		}
+		fcntl( listener.fd, F_SETFL, fcntl( listener.fd, F_GETFL ) | O_NONBLOCK );
+		watch( listener, EPOLL_CTL_ADD );
+		return true;
+	}
+
+	virtual bool alive()
+	{
+		return true;
+	}
+
+	virtual void handle( Watch* w, unsigned events )
+	{
+		if( w == &listener )
+		{
+			accept();
+		}
+		else if( w->session == NULL )
+		{
+			receive( pending[w->fd] );
+		}
+		else
+		{
+			Reactor::handle( w, events );
+		}
+	}
+
+	void done( Connection* c )
+	{
+		if( c->cached )
+		{
+			cache.release( c->source, c->path, c->generation, (ServedVm*) c->vm );
+		}
+		else
+		{
+			delete (ServedVm*) c->vm;
+		}
+		close( c->in.fd );
+		delete c;
+	}
+
+protected:
+	void watch( Watch& w, int op )
+	{
+		epoll_event e;
+		e.events = EPOLLIN;
+		e.data.ptr = &w;
+		epoll_ctl( epfd, op, w.fd, &e );
+	}
+
+	void accept()
+	{
+		int fd;
+		while( ( fd = ::accept( listener.fd, NULL, NULL ) ) >= 0 )
+		{
+			fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+			Pending* p = new Pending;
+			p->watch.session = NULL;
+			p->watch.fd = fd;
+			pending[fd] = p;
+			watch( p->watch, EPOLL_CTL_ADD );
+		}
+	}
+
+	void receive( Pending* p )
+	{
+		int fd = p->watch.fd;
+		char buffer[16 * 1024];
+		int n;
+		while( ( n = read( fd, buffer, sizeof( buffer ) ) ) < 0 && errno == EINTR )
+		{
+		}
+		if( n < 0 && errno == EAGAIN )
+		{
+			return;
+		}
+		if( n > 0 )
+		{
+			p->data.append( buffer, n );
+		}
+
+		int length = 0;
+		char flags[8] = "-";
+		int end = p->data.find( '\n' );
+		bool bad = ( n <= 0 ) || ( end < 0 && p->data.length() > 8 * 1024 );
+		if( end >= 0 &&
+			( sscanf( p->data.c_str(), "WSINTER %d %7s", &length, flags ) < 1 || length < 0 ) )
+		{
+			bad = true;
+		}
+		if( bad )
+		{
+			epoll_ctl( epfd, EPOLL_CTL_DEL, fd, NULL );
+			close( fd );
+			pending.erase( fd );
+			delete p;
+			return;
+		}
+		if( end < 0 || p->data.length() < end + 1 + length )
+		{
+			return;
+		}
+
+		// the program is complete, from here on the connection is a session
+		epoll_ctl( epfd, EPOLL_CTL_DEL, fd, NULL );
+		pending.erase( fd );
+
+		string header = p->data.substr( 0, end );
+		string path;
+		int space = header.find( ' ', header.find( ' ', 8 ) + 1 );
+		if( space >= 0 )
+		{
+			path = header.substr( space + 1 );
+		}
+		string source = p->data.substr( end + 1, length );
+		int generation;
+		ServedVm* vm = cache.acquire( source, path, generation );
+		if( !vm )
+		{
+			// the client gets the errors from a program that has already
+			// ended, they go out like any other output
+			Connection* c = new Connection( new ServedVm, fd, source, path );
+			c->cached = false;
+			c->vm->running = false;
+			for( int i = 0; i < cache.errors.size(); ++ i )
+			{
+				string line = cache.errors[i] + "\n";
+				c->io.write( line.data(), line.length() );
+			}
+			if( strchr( flags, 's' ) )
+			{
+				string trailer = statusTrailer( statusError );
+				c->io.write( trailer.data(), trailer.length() );
+			}
+			delete p;
+			add( c );
+			return;
+		}
+		vm->debug = ( strchr( flags, 'd' ) != NULL );
+
+		Connection* c = new Connection( vm, fd, source, path );
+		c->generation = generation;
+		c->status = ( strchr( flags, 's' ) != NULL );
+		int rest = end + 1 + length;
+		c->io.feed( p->data.data() + rest, p->data.length() - rest );
+		delete p;
+
+		add( c );
+	}
+};
+
+void Connection::finish( Reactor& reactor )
+{
+	( (Server&) reactor ).done( this );
+}
+
+#endif
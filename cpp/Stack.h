@@ -0,0 +1,135 @@
+// stack of ints in a reserved region of address space
+//
+// The whole capacity is reserved up front and framed by guard pages that can
+// not be touched, so push and pop are plain pointer bumps that never check
+// or reallocate.  Running over either end faults on a guard page, and the Vm
+// turns that fault into a runtime error (see Vm::resume).
+//
+// A pop reads the entry it drops, also where the value is not used (like
+// OpPop), so popping an empty stack faults at the pop itself and not at
+// some later op.
+
+#ifdef WIN32
+#include <windows.h>
+#define THREAD_LOCAL __declspec( thread )
+#else
+#include <sys/mman.h>
+#define THREAD_LOCAL __thread
+#endif
+
+class Stack
+{
+public:
+	int* top;	// one behind the last entry
+	int* base;
+
+protected:
+	int* limit;
+	char* region;
+	int regionSize;
+	int lowGuard;
+	int highGuard;
+
+public:
+	Stack( int capacity )
+	{
+		lowGuard = 1024 * 1024;
+		highGuard = 64 * 1024;
+		int bytes = ( capacity * sizeof( int ) + highGuard - 1 ) / highGuard * highGuard;
+		regionSize = lowGuard + bytes + highGuard;
+
+#ifdef WIN32
+		region = (char*) VirtualAlloc( NULL, regionSize, MEM_RESERVE, PAGE_NOACCESS );
+		assert( region );
+		VirtualAlloc( region + lowGuard, bytes, MEM_COMMIT, PAGE_READWRITE );
+#else
+		region = (char*) mmap( NULL, regionSize, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+		assert( region != MAP_FAILED );
+		mprotect( region + lowGuard, bytes, PROT_READ | PROT_WRITE );
+#endif
+
+		base = (int*) ( region + lowGuard );
+		limit = (int*) ( region + lowGuard + bytes );
+		top = base;
+	}
+
+	~Stack()
+	{
+#ifdef WIN32
+		VirtualFree( region, 0, MEM_RELEASE );
+#else
+		munmap( region, regionSize );
+#endif
+	}
+
+	void push_back( int v )
+	{
+		*top = v;
+		++ top;
+	}
+
+	void pop_back()
+	{
+		-- top;
+		*(volatile int*) top;
+	}
+
+	int& back()
+	{
+		return top[-1];
+	}
+
+	int& front()
+	{
+		return base[0];
+	}
+
+	int& operator[]( int i )
+	{
+		return base[i];
+	}
+
+	int size()
+	{
+		return top - base;
+	}
+
+	void clear()
+	{
+		top = base;
+	}
+
+	// makes the stack smaller, capacity is rounded up to whole pages of the
+	// guard, what is above becomes part of the guard
+	void setCapacity( int capacity )
+	{
+		int bytes = ( capacity * sizeof( int ) + highGuard - 1 ) / highGuard * highGuard;
+		char* end = region + lowGuard + bytes;
+		if( end >= (char*) limit )
+		{
+			return;
+		}
+#ifdef WIN32
+		VirtualFree( end, (char*) limit - end, MEM_DECOMMIT );
+#else
+		mprotect( end, (char*) limit - end, PROT_NONE );
+#endif
+		limit = (int*) end;
+	}
+
+	// -1 if address is in the guard below the stack, 1 if in the one above
+	int guardHit( void* address )
+	{
+		char* p = (char*) address;
+		if( p >= region && p < (char*) base )
+		{
+			return -1;
+		}
+		if( p >= (char*) limit && p < region + regionSize )
+		{
+			return 1;
+		}
+		return 0;
+	}
+};
@@ -0,0 +1,231 @@
+// tiered execution, with -t
+//
+// The program starts on the ops right away.  Every label becomes an OpHot
+// that counts how often its block is entered, and once one block was
+// entered hotness times a thread translates the program to the Ir while the
+// ops go on.  From then on every OpHot asks whether the Ir is done, and the
+// first one after that switches the Vm over.  The start of a block is the
+// same place in the ops and in the Ir, and so is every return address, as
+// the op behind a call starts a block; so the switch only maps ip and the
+// call stack through Ir::entry.  A program that ends before the Ir is done
+// never uses it.
+//
+// The thread translates a copy of the ops taken before the run, the run
+// quickens the ops in Vm::ops.  The passes of -O renumber the ops, so a
+// program that already runs has no place to go on in their result; with -t
+// they still run before the start, if at all, and the Ir is made of what
+// they left.
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+class Tier
+{
+public:
+	int hotness;	// entries of one block that start the translation
+	double startedAt;	// of the run
+	double translatingAt;	// 0 if the translation never started
+	double translatedAt;
+	int switchedAt;	// op index of the OpHot, -1 if the Vm never switched
+
+protected:
+	Vm* shadow;	// the ops the thread translates
+	Ir* ir;	// by the thread, NULL until it is done
+	bool started;
+#ifdef WIN32
+	HANDLE thread;
+	CRITICAL_SECTION lock;
+#else
+	pthread_t thread;
+	pthread_mutex_t lock;
+#endif
+
+public:
+	Tier()
+		:hotness( 1000 ),
+		startedAt( 0 ),
+		translatingAt( 0 ),
+		translatedAt( 0 ),
+		switchedAt( -1 ),
+		shadow( NULL ),
+		ir( NULL ),
+		started( false )
+	{
+#ifdef WIN32
+		InitializeCriticalSection( &lock );
+#else
+		pthread_mutex_init( &lock, NULL );
+#endif
+	}
+
+	~Tier()
+	{
+		if( started )
+		{
+#ifdef WIN32
+			WaitForSingleObject( thread, INFINITE );
+			CloseHandle( thread );
+#else
+			pthread_join( thread, NULL );
+#endif
+		}
+#ifdef WIN32
+		DeleteCriticalSection( &lock );
+#else
+		pthread_mutex_destroy( &lock );
+#endif
+		delete ir;
+		delete shadow;
+	}
+
+	// after the Limits, right before the run
+	void apply( Vm& vm )
+	{
+		vector< Op* > out;
+		for( int i = 0; i < vm.ops.size(); ++ i )
+		{
+			Op* op = vm.ops[i];
+			if( op->isLabel() )
+			{
+				// a labelled charge pays behind the OpHot, so the Ir
+				// starts the block with it as well
+				OpLabel* label = (OpLabel*) op;
+				out.push_back( ARENA_NEW( vm.arena, OpHot )( label->label ) );
+				if( op->getCode() == opLabel )
+				{
+					continue;
+				}
+				label->label = -1;
+			}
+			out.push_back( op );
+		}
+		vm.ops.swap( out );
+		vm.buildLabels();
+
+		shadow = new Vm;
+		shadow->ops = vm.ops;
+		shadow->labels = vm.labels;
+		shadow->checked = vm.checked;
+		shadow->heapLimit = vm.heapLimit;
+
+		vm.tier = this;
+		vm.hotness = hotness;
+		startedAt = metricsClock();
+	}
+
+	// from an OpHot whose block is hot, ip is right behind it
+	void up( Vm& vm )
+	{
+		if( !started )
+		{
+			translatingAt = metricsClock();
+			started = start();
+			vm.hotness = started ? 0 : INT_MAX;	// every block asks from now on
+			return;
+		}
+
+		enter();
+		Ir* translated = ir;
+		ir = NULL;
+		leave();
+		if( !translated )
+		{
+			return;
+		}
+
+		vector< int >& entry = translated->entry;
+		for( int i = 0; i < vm.calls.size(); ++ i )
+		{
+			vm.calls[i] = entry[ vm.calls[i] ];
+		}
+		switchedAt = vm.ip - 1;
+		vm.ip = entry[switchedAt];
+		vm.ir = translated;
+		vm.hotness = INT_MAX;
+		vm.running = false;	// loop() goes on in the Ir
+	}
+
+	void dump( ostream& out )
+	{
+		if( !translatingAt )
+		{
+			out << "tier: the program ended on the ops" << endl;
+			return;
+		}
+		out << "tier: hot after " << milliseconds( translatingAt - startedAt ) << " ms";
+		enter();
+		double translated = translatedAt;
+		leave();
+		if( translated )
+		{
+			out << ", translated in " << milliseconds( translated - translatingAt ) << " ms";
+		}
+		if( switchedAt >= 0 )
+		{
+			out << ", switched at op " << switchedAt;
+		}
+		else
+		{
+			out << ", the program ended before the switch";
+		}
+		out << endl;
+	}
+
+protected:
+	bool start()
+	{
+#ifdef WIN32
+		DWORD id;
+		thread = CreateThread( NULL, 0, translate, this, 0, &id );
+		return thread != NULL;
+#else
+		return pthread_create( &thread, NULL, translate, this ) == 0;
+#endif
+	}
+
+#ifdef WIN32
+	static DWORD WINAPI translate( LPVOID p )
+#else
+	static void* translate( void* p )
+#endif
+	{
+		Tier* tier = (Tier*) p;
+		Ir* translated = new Ir( *tier->shadow );
+		tier->enter();
+		tier->ir = translated;
+		tier->translatedAt = metricsClock();
+		tier->leave();
+		return 0;
+	}
+
+	void enter()
+	{
+#ifdef WIN32
+		EnterCriticalSection( &lock );
+#else
+		pthread_mutex_lock( &lock );
+#endif
+	}
+
+	void leave()
+	{
+#ifdef WIN32
+		LeaveCriticalSection( &lock );
+#else
+		pthread_mutex_unlock( &lock );
+#endif
+	}
+
+	static string milliseconds( double seconds )
+	{
+		char buffer[32];
+		sprintf( buffer, "%.3f", seconds * 1000 );
+		return buffer;
+	}
+};
+
+void Vm::tierUp()
+{
+	tier->up( *this );
+}
@@ -0,0 +1,219 @@
+// wsclient: runs a program on a wsinter --serve daemon
+//
+// Takes the same arguments as wsinter and behaves the same from the outside,
+// but the program is parsed (once) and run by the daemon.  The client only
+// sends the source and shovels stdin to the daemon and the output back, and
+// returns the exit status the daemon sends behind the output.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+#ifndef WIN32
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define WSINTER_SOCKET "/tmp/wsinter.socket"
+#define WSINTER_STATUS_LENGTH 8
+
+bool writeAll( int fd, const char* p, int n )
+{
+	while( n > 0 )
+	{
+		int w = write( fd, p, n );
+		if( w < 0 )
+		{
+			if( errno == EINTR )
+			{
+				continue;
+			}
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+int connectTo( const char* path )
+{
+	sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if( strlen( path ) >= sizeof( address.sun_path ) )
+	{
+		return -1;
+	}
+	strcpy( address.sun_path, path );
+
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( fd >= 0 && connect( fd, (sockaddr*) &address, sizeof( address ) ) != 0 )
+	{
+		close( fd );
+		fd = -1;
+	}
+	return fd;
+}
+
+// the status from the end of the answer, 1 if the daemon sent none
+int statusOf( const string& trailer )
+{
+	if( trailer.length() != WSINTER_STATUS_LENGTH || trailer[0] != 0 ||
+		trailer.compare( 1, 2, "ws" ) != 0 || trailer[WSINTER_STATUS_LENGTH - 1] != '\n' )
+	{
+		writeAll( 1, trailer.data(), trailer.length() );
+		return 1;
+	}
+	return atoi( trailer.c_str() + 3 );
+}
+
+// copies stdin to the daemon and its answer to stdout until it hangs up, the
+// last bytes are held back as they may be the status
+int pump( int fd )
+{
+	string held;
+	pollfd fds[2];
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = 0;
+	fds[1].events = POLLIN;
+	int count = 2;
+
+	char buffer[16 * 1024];
+	for( ;; )
+	{
+		if( poll( fds, count, -1 ) < 0 )
+		{
+			if( errno == EINTR )
+			{
+				continue;
+			}
+			return 1;
+		}
+
+		if( fds[0].revents )
+		{
+			int n = read( fd, buffer, sizeof( buffer ) );
+			if( n <= 0 )
+			{
+				return statusOf( held );
+			}
+			held.append( buffer, n );
+			if( held.length() > WSINTER_STATUS_LENGTH )
+			{
+				int out = held.length() - WSINTER_STATUS_LENGTH;
+				writeAll( 1, held.data(), out );
+				held.erase( 0, out );
+			}
+		}
+
+		if( count > 1 && fds[1].revents )
+		{
+			int n = read( 0, buffer, sizeof( buffer ) );
+			if( n <= 0 || !writeAll( fd, buffer, n ) )
+			{
+				shutdown( fd, SHUT_WR );
+				count = 1;
+			}
+		}
+	}
+}
+
+#endif
+
+int main( int argc, char* argv[] )
+{
+	bool debug = false;
+	const char* path = NULL;
+
+    cout << "WhiteSpace interpreter in C++ (speedy!!)" << endl;
+    cout << "Made by Oliver Burghard Smarty21@gmx.net" << endl;
+    cout << "in his free time for your and his joy" << endl;
+    cout << "good time and join me to get Whitespace ready for business" << endl;
+    cout << "For any other information dial 1-900-WHITESPACE" << endl;
+    cout << "Or get soon info at www.WHITESPACE-WANTS-TO-BE-TAKEN-SERIOUS.org" << endl;
+    cout << "-- WS Interpreter C++ ------------------------------------------" << endl;
+
+	if( argc < 2 )
+	{
+		cout << "wsclient [filename] [-d] [-s socket]" << endl;
+		return 0;
+	}
+
+	for( int a = 2; a < argc; ++ a )
+	{
+		if( strcmp( argv[a], "-d" ) == 0 )
+		{
+			debug = true;
+		}
+		else if( ( strcmp( argv[a], "-s" ) == 0 ) && ( a + 1 < argc ) )
+		{
+			path = argv[++ a];
+		}
+	}
+
+#ifndef WIN32
+	if( path == NULL )
+	{
+		path = getenv( "WSINTER_SOCKET" ) ? getenv( "WSINTER_SOCKET" ) : WSINTER_SOCKET;
+	}
+
+	ifstream filein( argv[1], ios::in | ios::binary );
+	if( !filein )
+	{
+		cout << "can not open " << argv[1] << endl;
+		return 1;
+	}
+	string file;
+	char chunk[16 * 1024];
+	while( filein.read( chunk, sizeof( chunk ) ) || filein.gcount() )
+	{
+		file.append( chunk, filein.gcount() );
+	}
+
+	int fd = connectTo( path );
+	if( fd < 0 )
+	{
+		cout << "no wsinter --serve running on " << path << endl;
+		return 1;
+	}
+
+	// a .wsa source is assembled by the daemon, its includes are looked up
+	// next to the full path
+	string name( argv[1] );
+	bool assembly = name.length() > 4 && name.compare( name.length() - 4, 4, ".wsa" ) == 0;
+	char full[PATH_MAX];
+	if( assembly && !realpath( argv[1], full ) )
+	{
+		cout << "can not find " << argv[1] << endl;
+		return 1;
+	}
+	char header[64 + PATH_MAX];
+	sprintf( header, "WSINTER %d %s%s%s\n", (int) file.length(), debug ? "ds" : "s",
+		assembly ? " " : "", assembly ? full : "" );
+
+	int status = 1;
+	cout.flush();
+	if( writeAll( fd, header, strlen( header ) ) && writeAll( fd, file.data(), file.length() ) )
+	{
+		status = pump( fd );
+	}
+	close( fd );
+	return status;
+#else
+	cout << "wsclient is not supported on this platform" << endl;
+	return 0;
+#endif
+}
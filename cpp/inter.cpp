@@ -3,18 +3,38 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <map>
+#include <new>
+#include <algorithm>
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <typeinfo.h>
 
 using namespace std;
 
+#include "Io.h"
+#include "Arena.h"
+#include "Stack.h"
+#include "Labels.h"
+#include "Semantics.h"
+
+
 class Op
 {
 public:
+	bool deoptimized;	// a quick variant did not pay off, stay generic
+
 	Op()
+		:deoptimized( false )
 	{
 	}
 	
@@ -26,6 +46,18 @@ public:
 	{
 	}
 
+	// what run() does without rewriting the op into a quick variant
+	virtual void runGeneric( class Vm& vm )
+	{
+		run( vm );
+	}
+
+	// the op a quick variant stands in for
+	virtual Op* getGeneric()
+	{
+		return this;
+	}
+
 	virtual char* getName( ) = 0;
 
 	virtual void getRunInfo( ostream& out )
@@ -34,6 +66,13 @@ public:
 	}
 
 	virtual bool isLabel() { return false; };
+
+	virtual int getCode() { return opOther; };
+
+	// called once the op is read, while the byte code it came from is still there
+	virtual void intern( class Vm& vm )
+	{
+	}
 	
 	// helper
 	void putInHeap( class Vm& vm, int i, int v );
@@ -53,7 +92,8 @@ public:
 
 	virtual char* getSignature() = 0;
 
-	virtual bool read( string s, Op*& op, int& length ) = 0;
+	// s points into the byte code, n characters are left
+	virtual bool read( class Vm& vm, const char* s, int n, Op*& op, int& length ) = 0;
 };
 
 
@@ -61,36 +101,105 @@ class Vm
 {
 public:
 	bool running;
+	bool blocked;
 	bool debug;
+	bool watched;	// debug or metrics, watch() every op
+	bool checked;	// arithmetic that overflows stops the program
 	int ip;
-	vector<int> stack;
+	Arena arena;	// owns the ops and op classes
+	Stack stack;
+	Stack calls;	// return addresses
 	vector<int> heap;
 	vector< Op* > ops;
-	map< int, int > labels;
+	LabelTable labelIds;
+	vector< int > labels;	// op index of every label id
+	class Ir* ir;	// the program translated to registers, NULL runs the ops
+	class Metrics* metrics;	// NULL counts nothing
+	class Limits* limits;	// NULL has none
+	int gas;	// instructions OpCharge may still pay for before refuel()
+	int heapLimit;	// cells
+	class Tier* tier;	// NULL stays on the ops or the Ir
+	int hotness;	// block entries an OpHot tells the Tier about
 	vector< OpClass* > allOpClasses;
+	Io* io;
+	const char* error;	// why the program was stopped, NULL if it was not
+	int errorIp;
 
+	static THREAD_LOCAL Vm* current;	// the one that is running on this thread
+#ifndef WIN32
+	sigjmp_buf faultJump;
+#endif
 
 	Vm();
 
-	~Vm()
+	~Vm();
+
+	void run()
 	{
-		for( int i3 = 0; i3 < allOpClasses.size(); ++ i3 )
+		ip = 0;
+		resume();
+	}
+
+	// runs until the program ends, blocks on io or has used up its slice
+	// of instructions (slice < 0 runs without limit)
+	void resume( int slice = -1 )
+	{
+		running = true;
+		blocked = false;
+		watched = debug || metrics;
+		if( metrics )
 		{
-			delete allOpClasses[i3];
+			meterResume();
 		}
-		allOpClasses.clear();
 
-		for( int i2 = 0; i2 < ops.size(); ++ i2 )
+		Vm* outer = current;
+		current = this;
+#ifdef WIN32
+		__try
 		{
-			delete ops[i2];
+			guarded( slice );
+		}
+		__except( guardFilter( GetExceptionInformation() ) )
+		{
+		}
+#else
+		if( sigsetjmp( faultJump, 0 ) == 0 )
+		{
+			guarded( slice );
+		}
+#endif
+		current = outer;
+
+		if( error )
+		{
+			fail();
+		}
+		if( metrics && blocked )
+		{
+			meterSuspend();
 		}
-		ops.clear();
 	}
 
-	void run()
+	// a heap that can not grow ends the program instead of the process
+	void guarded( int slice )
 	{
-		running = true;
-		ip = 0;
+		try
+		{
+			loop( slice );
+		}
+		catch( bad_alloc& )
+		{
+			stop( "out of memory" );
+		}
+	}
+
+	void loop( int slice )
+	{
+		if( ir )
+		{
+			loopIr( slice );
+			return;
+		}
 
 		while( running )
 		{
@@ -98,6 +207,10 @@ public:
 			{
 				running = false;
 			}
+			else if( slice >= 0 && slice-- == 0 )
+			{
+				suspend( false );
+			}
 			else
 			{
 				assert( ip >= 0 );
@@ -105,31 +218,164 @@ public:
 				Op* op = ops[ip];
 				assert( op );
 				++ ip;
-				if( debug )
+				if( watched )
 				{
-					cout << ip << " ";
-					op->getRunInfo( cout );
-					cout << endl;
+					watch( op );
 				}
 
 				op->run( *this );
 			}
 		}
+
+		// the Tier switched to the Ir at the start of a block
+		if( ir )
+		{
+			running = true;
+			loopIr( slice );
+		}
+	}
+
+	// the trace of -d and the counts of -M, before op runs
+	void watch( Op* op );
+
+	void loopIr( int slice );
+
+	// tell the Metrics, defined behind them
+	void meter( int code );
+	void meterResume();
+	void meterSuspend();
+
+	// asks the Limits for more gas, stops the program if there is none
+	void refuel();
+
+	// instructions done in one go, false if the Limits have not that many
+	// left; true without Limits
+	bool pay( double instructions );
+
+	// a block is hot, the Tier may switch to the Ir
+	void tierUp();
+
+	// index of the op the last instruction came from, plus one like ip
+	int opIp();
+
+	// stops the run loop, resume() goes on with the next op or, when
+	// retry is set, runs the current one again
+	void suspend( bool retry )
+	{
+		if( retry )
+		{
+			-- ip;
+		}
+		blocked = true;
+		running = false;
+	}
+
+	bool finished()
+	{
+		return !running && !blocked;
+	}
+
+	// called from the fault handler, true if address is in a guard page
+	bool hitGuard( void* address )
+	{
+		int hit = stack.guardHit( address );
+		if( hit )
+		{
+			error = ( hit < 0 ) ? "operand stack underflow" : "operand stack overflow";
+		}
+		else
+		{
+			hit = calls.guardHit( address );
+			if( hit )
+			{
+				error = ( hit < 0 ) ? "ret without call" : "call stack overflow";
+			}
+		}
+		if( hit )
+		{
+			errorIp = opIp();
+		}
+		return hit != 0;
+	}
+
+	// stops the program with an error at the running op
+	void stop( const char* why )
+	{
+		error = why;
+		errorIp = opIp();
+		running = false;
+		blocked = false;
+	}
+
+#ifdef WIN32
+	int guardFilter( EXCEPTION_POINTERS* e )
+	{
+		if( e->ExceptionRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION &&
+			hitGuard( (void*) e->ExceptionRecord->ExceptionInformation[1] ) )
+		{
+			return EXCEPTION_EXECUTE_HANDLER;
+		}
+		return EXCEPTION_CONTINUE_SEARCH;
 	}
+#endif
 
-	void buildLabels();
+	// stops the program for good and tells why
+	void fail()
+	{
+		running = false;
+		blocked = false;
+
+		ostringstream out;
+		out << endl << "runtime error: " << error << " at " << errorIp;
+		if( errorIp > 0 && errorIp <= ops.size() )
+		{
+			out << " (" << ops[errorIp - 1]->getName() << ")";
+		}
+		out << endl;
+		io->error( out.str().c_str(), out.str().length() );
+		io->flush();
+	}
+
+	// replaces the running op by a quick variant of it, or back
+	void quicken( Op* from, Op* to )
+	{
+		if( ip > 0 && ops[ip - 1] == from )
+		{
+			ops[ip - 1] = to;
+		}
+	}
+
+	// forgets the state of the last run, the program stays loaded
+	void reset()
+	{
+		running = true;
+		blocked = false;
+		ip = 0;
+		error = NULL;
+		stack.clear();
+		calls.clear();
+		heap.clear();
+		io = &stdIo;
+	}
+
+	// false when a label is defined twice
+	bool buildLabels();
+
+	// translates the ops to registers, after buildLabels
+	void buildIr();
 
 	void buildOps( const string& data_byte_code )
 	{
-		string data_byte_code_2( data_byte_code );
-		while( data_byte_code_2.length() )
+		const char* code = data_byte_code.c_str();
+		int left = data_byte_code.length();
+		while( left > 0 )
 		{
 			Op* op = NULL;
 			int length = 0;
 			for( int i = 0; (i < allOpClasses.size()) && (!op); ++ i )
 			{
 				OpClass& oc = *allOpClasses[i];
-				if( oc.read( data_byte_code_2, op, length ) )
+				if( oc.read( *this, code, left, op, length ) )
 				{
 					assert( op );
 					assert( length >= 0 );
@@ -143,14 +389,15 @@ public:
 
 			if( op == NULL )
 			{
-				cout << "can not parse: " << data_byte_code_2.substr( 0, 50 ).c_str() << endl;
+				cout << "can not parse: " << string( code, __min( left, 50 ) ).c_str() << endl;
 				length = 1;
 				op = NULL;
 			}
 
 			if( length >= 0 )
 			{
-				data_byte_code_2.erase( 0, length );
+				code += length;
+				left -= length;
 			}
 
 			if( op )
@@ -163,7 +410,11 @@ public:
 
 void Op::putInHeap( Vm& vm, int i, int v )
 {
-	assert( i >= 0 );
+	if( i < 0 || i >= vm.heapLimit )
+	{
+		vm.stop( ( i < 0 ) ? "negative heap address" : "heap limit" );
+		return;
+	}
 	vm.heap.resize( __max( vm.heap.size(), i + 1 ) );
 	vm.heap[i] = v;
 }
@@ -176,25 +427,26 @@ class OpTemplateClass: public OpClass
 		return Base::getSignature();
 	}
 
-	virtual bool read( string s, Op*& op, int& length )
+	virtual bool read( Vm& vm, const char* s, int n, Op*& op, int& length )
 	{
-		string sig = getSignature();
-		string sig2 = s.substr( 0, sig.length() );
-		if( sig.compare(sig2) == 0 )
+		char* sig = getSignature();
+		int sigLen = strlen( sig );
+		if( n >= sigLen && memcmp( s, sig, sigLen ) == 0 )
 		{
-			length = sig.length();
+			length = sigLen;
 
 			int subLen = 0;
-			string subStr = s.substr( length, s.length() - length );
-			op = new Base( subStr, subLen );
+			char* mark = vm.arena.mark();
+			op = ARENA_NEW( vm.arena, Base )( s + length, n - length, subLen );
 			if( subLen >= 0 )
 			{
+				op->intern( vm );
 				length += subLen;
 				return true;
 			}
 			else
 			{
-				delete op;
+				vm.arena.release( mark );
 				return false;
 			}
 		}
@@ -207,10 +459,72 @@ class OpTemplateClass: public OpClass
 };
 
 #include "ops.h"
+#include "Cfg.h"
+#include "Ranges.h"
+#include "Optimizer.h"
+#include "Memo.h"
+#include "Ir.h"
+#include "Metrics.h"
+#include "Limits.h"
+#include "Replay.h"
+#include "Tier.h"
+#include "Layout.h"
+#include "Reactor.h"
+
+
+StdIo stdIo;
+
+THREAD_LOCAL Vm* Vm::current = NULL;
+
+#ifndef WIN32
+void onGuardFault( int sig, siginfo_t* info, void* context )
+{
+	Vm* vm = Vm::current;
+	if( vm && vm->hitGuard( info->si_addr ) )
+	{
+		siglongjmp( vm->faultJump, 1 );
+	}
+
+	// not a stack running over, crash as usual
+	signal( sig, SIG_DFL );
+}
+
+void installGuardHandler()
+{
+	static bool installed = false;
+	if( !installed )
+	{
+		installed = true;
 
+		struct sigaction action;
+		memset( &action, 0, sizeof( action ) );
+		action.sa_sigaction = onGuardFault;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigaction( SIGSEGV, &action, NULL );
+		sigaction( SIGBUS, &action, NULL );
+	}
+}
+#endif
 
-void Vm::buildLabels()
+void Vm::watch( Op* op )
 {
+	if( metrics )
+	{
+		meter( op->getCode() );
+	}
+	if( debug )
+	{
+		ostringstream info;
+		info << ip << " ";
+		op->getRunInfo( info );
+		info << endl;
+		io->write( info.str().c_str(), info.str().length() );
+	}
+}
+
+bool Vm::buildLabels()
+{
+	labels.assign( labelIds.size(), -1 );
 	for( int i = 0; i < ops.size(); ++ i )
 	{
 		Op* op = ops[i];
@@ -219,52 +533,204 @@ void Vm::buildLabels()
 		{
 			OpLabel* l = (OpLabel*) op;
 
-			assert( labels.find(l->label) == labels.end() );
-			
+			if( labels[l->label] >= 0 )
+			{
+				return false;
+			}
 			labels[l->label] = i;
-			//.add( make_pair( l->label, i );
 		}
 
 	}
+
+	// jumping to a label that is nowhere ends the program
+	for( int i2 = 0; i2 < labels.size(); ++ i2 )
+	{
+		if( labels[i2] < 0 )
+		{
+			labels[i2] = ops.size();
+		}
+	}
+	return true;
 }
 
 Vm::Vm()
 	:running( true ),
+	blocked( false ),
+	debug( false ),
+	watched( false ),
+	checked( false ),
 	ip( 0 ),
-	debug( false )
+	stack( 16 * 1024 * 1024 ),
+	calls( 1024 * 1024 ),
+	ir( NULL ),
+	metrics( NULL ),
+	limits( NULL ),
+	gas( 0 ),
+	heapLimit( INT_MAX ),
+	tier( NULL ),
+	hotness( INT_MAX ),
+	io( &stdIo ),
+	error( NULL ),
+	errorIp( 0 )
+{
+#ifndef WIN32
+	installGuardHandler();
+#endif
+
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassPush ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassPop ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassLabel ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassDoub ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassSwap ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassAdd ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassSub ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassMul ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassDiv ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassMod ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassStore ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassRetrive ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassCall ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassJump ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassJumpZ ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassJumpN ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassRet ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassExit ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassOutC ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassOutN ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassInC ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassInN ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassDebugPrintStack ) );
+	allOpClasses.push_back( ARENA_NEW( arena, OpClassDebugPrintHeap ) );
+}
+
+// keeps the white space of a source file, spelled a (space), b (tab)
+// and c (line feed)
+string toByteCode( const string& file )
 {
-	allOpClasses.push_back( new OpClassPush );
-	allOpClasses.push_back( new OpClassPop );
-	allOpClasses.push_back( new OpClassLabel );
-	allOpClasses.push_back( new OpClassDoub );
-	allOpClasses.push_back( new OpClassSwap );
-	allOpClasses.push_back( new OpClassAdd );
-	allOpClasses.push_back( new OpClassSub );
-	allOpClasses.push_back( new OpClassMul );
-	allOpClasses.push_back( new OpClassDiv );
-	allOpClasses.push_back( new OpClassMod );
-	allOpClasses.push_back( new OpClassStore );
-	allOpClasses.push_back( new OpClassRetrive );
-	allOpClasses.push_back( new OpClassCall );
-	allOpClasses.push_back( new OpClassJump );
-	allOpClasses.push_back( new OpClassJumpZ );
-	allOpClasses.push_back( new OpClassJumpN );
-	allOpClasses.push_back( new OpClassRet );
-	allOpClasses.push_back( new OpClassExit );
-	allOpClasses.push_back( new OpClassOutC );
-	allOpClasses.push_back( new OpClassOutN );
-	allOpClasses.push_back( new OpClassInC );
-	allOpClasses.push_back( new OpClassInN );
-	allOpClasses.push_back( new OpClassDebugPrintStack );
-	allOpClasses.push_back( new OpClassDebugPrintHeap );
+	string data_byte_code;
+	data_byte_code.reserve( file.length() );
+	for( int i = 0; i < file.length(); ++ i )
+	{
+		char ch = file[i];
+		if( ch == ' ' )
+		{
+			data_byte_code += 'a';
+		}
+		else if( ch == '\t' )
+		{
+			data_byte_code += 'b';
+		}
+		else if( ch == '\n' )
+		{
+			data_byte_code += 'c';
+		}
+		else
+		{
+		}
+	}
+
+	return data_byte_code;
+}
+
+#include "Assembler.h"
+#include "Linker.h"
+
+// the byte code of a program from what its file holds: white space, what
+// --asm wrote, or with assembly a .wsa source whose includes are looked up
+// next to name and listed in includes; false with the errors if that does
+// not assemble
+bool toProgram( const string& file, const string& name, bool assembly,
+	string& data_byte_code, vector< string >& errors, vector< string >& includes )
+{
+	includes.clear();
+
+	// .wsa sources, and what --asm wrote, need no white space round trip
+	if( assembly )
+	{
+		Assembler assembler;
+		bool ok = assembler.assembleSource( file, name );
+		assembler.includedFiles( includes );
+		if( !ok )
+		{
+			errors = assembler.errors;
+			return false;
+		}
+		data_byte_code = assembler.code;
+	}
+	else if( Assembler::isPacked( file ) )
+	{
+		data_byte_code = Assembler::unpack( file );
+	}
+	else if( file.compare( 0, strlen( BYTECODE_MAGIC ), BYTECODE_MAGIC ) == 0 )
+	{
+		data_byte_code = file.substr( strlen( BYTECODE_MAGIC ) );
+	}
+	else
+	{
+		data_byte_code = toByteCode( file );
+	}
+	return true;
 }
 
+#include "Server.h"
+
+// the byte code of the program in the file name
+bool readProgram( const string& name, string& data_byte_code )
+{
+	ifstream filein( name.c_str() );
+	filein.seekg( 0, ios::end );
+	int size = filein.tellg();
+	if( size < 0 )
+	{
+		cerr << "can not read " << name << endl;
+		return false;
+	}
+	filein.seekg( 0, ios::beg );
+
+	char* buffer = new char[size];
+	filein.read( buffer, size );
+	int nsize = filein.gcount();
+//	assert( nsize == size );
 
+	string file( buffer, nsize );
+	
+	
+	delete [] buffer;
+
+	vector< string > errors;
+	vector< string > includes;
+	bool assembly = name.length() > 4 && name.compare( name.length() - 4, 4, ".wsa" ) == 0;
+	if( !toProgram( file, name, assembly, data_byte_code, errors, includes ) )
+	{
+		for( int i = 0; i < errors.size(); ++ i )
+		{
+			cerr << errors[i] << endl;
+		}
+		return false;
+	}
+	return true;
+}
+
+#include "Pipeline.h"
 
 
 int main( int argc, char* argv[] )
 {
 	bool debug = false; 
+	bool nonBlocking = false;
+	bool registers = false;
+	bool optimize = false;
+	bool stats = false;
+	bool checked = false;
+	bool memoize = false;
+	bool metered = false;
+	Limits limits;
+	bool limited = false;
+	const char* record = NULL;
+	const char* replay = NULL;
+	bool tiered = false;
+	const char* profilePath = NULL;	// collected into
+	const char* layoutPath = NULL;	// laid out by
 
     cout << "WhiteSpace interpreter in C++ (speedy!!)" << endl;
     cout << "Made by Oliver Burghard Smarty21@gmx.net" << endl;
@@ -276,66 +742,444 @@ int main( int argc, char* argv[] )
 
 	if( argc < 2 )
 	{
-		cout << "wsinter [filename] [-d]" << endl;
+		cout << "wsinter [filename] [-d] [-n] [-r] [-O] [-s] [-c] [-m] [-M] [-L limits] [-R log | -P log] [-t] [-F profile | -U profile]" << endl;
+		cout << "wsinter --pipe [filename ...] [-r] [-O] [-m] [-c]" << endl;
+		cout << "wsinter --serve [socket] [-L limits]" << endl;
+		cout << "wsinter --asm [filename.wsa] [-o out] [-f ws|packed|bytecode|module] [-I dir] [-D option] [-H heap]" << endl;
+		cout << "wsinter --link [filename.wsa|.wso ...] [-o out] [-f ws|packed|bytecode] [-I dir] [-D option] [-H heap]" << endl;
 	}
-	else
+	else if( strcmp( argv[1], "--asm" ) == 0 || strcmp( argv[1], "--link" ) == 0 )
 	{
-		ifstream filein( argv[1] );
-		filein.seekg( 0, ios::end );
-		int size = filein.tellg();
-		assert( size >= 0 );
-		filein.seekg( 0, ios::beg );
-
-		if( ( argc > 2 ) && ( strcmp( argv[2], "-d" ) == 0 ) )
+		bool link = ( strcmp( argv[1], "--link" ) == 0 );
+		Assembler assembler;
+		Linker linker;
+		vector< string > in;
+		string out;
+		string format( "ws" );
+		for( int a = 2; a < argc; ++ a )
+		{
+			if( strcmp( argv[a], "-o" ) == 0 && a + 1 < argc )
+			{
+				out = argv[++ a];
+			}
+			else if( strcmp( argv[a], "-f" ) == 0 && a + 1 < argc )
+			{
+				format = argv[++ a];
+			}
+			else if( strcmp( argv[a], "-I" ) == 0 && a + 1 < argc )
+			{
+				assembler.includePaths.push_back( argv[++ a] );
+			}
+			else if( strcmp( argv[a], "-D" ) == 0 && a + 1 < argc )
+			{
+				assembler.options[ argv[++ a] ] = true;
+			}
+			else if( strcmp( argv[a], "-H" ) == 0 && a + 1 < argc )
+			{
+				assembler.heapBase = atoi( argv[++ a] );
+			}
+			else
+			{
+				in.push_back( argv[a] );
+			}
+		}
+		if( in.empty() || ( in.size() > 1 && !link ) )
 		{
-			debug = true;
+			cerr << "one file to assemble, or files to link" << endl;
+			return 1;
+		}
+		if( out.empty() )
+		{
+			int dot = in[0].find_last_of( '.' );
+			out = ( dot >= 0 ? in[0].substr( 0, dot ) : in[0] ) +
+				( format == "ws" ? ".ws" : format == "packed" ? ".wsp" : format == "module" ? ".wso" : ".wsb" );
 		}
 
-		char* buffer = new char[size];
-		filein.read( buffer, size );
-		int nsize = filein.gcount();
-//		assert( nsize == size );
+		string byteCode;
+		vector< string >* errors = &assembler.errors;
+		bool ok = true;
+		if( link )
+		{
+			linker.includePaths = assembler.includePaths;
+			linker.options = assembler.options;
+			linker.heapBase = assembler.heapBase;
+			ok = linker.link( in );
+			byteCode = linker.code;
+			errors = &linker.errors;
+		}
+		else
+		{
+			assembler.module = ( format == "module" );
+			ok = assembler.assembleFile( in[0] );
+			byteCode = assembler.code;
+		}
+		if( !ok )
+		{
+			for( int i = 0; i < errors->size(); ++ i )
+			{
+				cerr << ( *errors )[i] << endl;
+			}
+			return 1;
+		}
 
-		string file( buffer, nsize );
-		
-		
-		delete [] buffer;
+		string data;
+		if( format == "ws" )
+		{
+			data = Assembler::toWhitespace( byteCode );
+		}
+		else if( format == "packed" )
+		{
+			data = Assembler::pack( byteCode );
+		}
+		else if( format == "bytecode" )
+		{
+			data = BYTECODE_MAGIC + byteCode;
+		}
+		else if( format == "module" && !link )
+		{
+			Module m;
+			assembler.toModule( m );
+			data = m.write();
+		}
+		else
+		{
+			cerr << "unknown format " << format << endl;
+			return 1;
+		}
 
-		string data_byte_code;
-		data_byte_code.reserve( file.length() );
-		for( int i = 0; i < file.length(); ++ i )
+		ofstream fileout( out.c_str(), ios::out | ios::binary );
+		fileout.write( data.data(), data.length() );
+		if( !fileout )
+		{
+			cerr << "can not write " << out << endl;
+			return 1;
+		}
+		cout << out << ": " << data.length() << " bytes";
+		if( link )
+		{
+			cout << ", " << linker.assembled << " modules assembled, " << linker.cached << " cached";
+		}
+		cout << endl;
+	}
+	else if( strcmp( argv[1], "--pipe" ) == 0 )
+	{
+		Pipeline pipeline;
+		vector< string > paths;
+		for( int a = 2; a < argc; ++ a )
 		{
-			char ch = file[i];
-			if( ch == ' ' )
+			if( strcmp( argv[a], "-r" ) == 0 )
+			{
+				pipeline.registers = true;
+			}
+			else if( strcmp( argv[a], "-O" ) == 0 )
 			{
-				data_byte_code += 'a';
+				pipeline.optimize = true;
 			}
-			else if( ch == '\t' )
+			else if( strcmp( argv[a], "-m" ) == 0 )
 			{
-				data_byte_code += 'b';
+				pipeline.memoize = true;
 			}
-			else if( ch == '\n' )
+			else if( strcmp( argv[a], "-c" ) == 0 )
+			{
+				pipeline.checked = true;
+				pipeline.registers = true;
+			}
+			else
+			{
+				paths.push_back( argv[a] );
+			}
+		}
+		if( paths.empty() || !pipeline.load( paths ) )
+		{
+			return 1;
+		}
+		return pipeline.run();
+	}
+	else if( strcmp( argv[1], "--serve" ) == 0 )
+	{
+#ifndef WIN32
+		const char* path = WSINTER_SOCKET;
+		Server server;
+		for( int a = 2; a < argc; ++ a )
+		{
+			if( strcmp( argv[a], "-L" ) == 0 && a + 1 < argc )
 			{
-				data_byte_code += 'c';
+				if( !server.cache.limits.parse( argv[++ a] ) )
+				{
+					cout << "limits are instructions=n,seconds=s,stack=n,calls=n,heap=bytes" << endl;
+					return 1;
+				}
 			}
 			else
 			{
+				path = argv[a];
+			}
+		}
+		if( !server.listen( path ) )
+		{
+			cout << "can not listen on " << path << endl;
+			return 1;
+		}
+		cout << "serving on " << path << endl;
+		server.loop();
+#else
+		cout << "--serve is not supported on this platform" << endl;
+#endif
+	}
+	else
+	{
+		for( int a = 2; a < argc; ++ a )
+		{
+			if( strcmp( argv[a], "-d" ) == 0 )
+			{
+				debug = true;
+			}
+			else if( strcmp( argv[a], "-n" ) == 0 )
+			{
+				nonBlocking = true;
+			}
+			else if( strcmp( argv[a], "-r" ) == 0 )
+			{
+				registers = true;
+			}
+			else if( strcmp( argv[a], "-O" ) == 0 )
+			{
+				optimize = true;
+			}
+			else if( strcmp( argv[a], "-s" ) == 0 )
+			{
+				stats = true;
+			}
+			else if( strcmp( argv[a], "-c" ) == 0 )
+			{
+				// the checks live in the register code
+				checked = true;
+				registers = true;
+			}
+			else if( strcmp( argv[a], "-m" ) == 0 )
+			{
+				memoize = true;
+			}
+			else if( strcmp( argv[a], "-M" ) == 0 )
+			{
+				metered = true;
+			}
+			else if( strcmp( argv[a], "-L" ) == 0 && a + 1 < argc )
+			{
+				if( !limits.parse( argv[++ a] ) )
+				{
+					cout << "limits are instructions=n,seconds=s,stack=n,calls=n,heap=bytes" << endl;
+					return statusError;
+				}
+				limited = true;
+			}
+			else if( strcmp( argv[a], "-t" ) == 0 )
+			{
+				tiered = true;
+			}
+			else if( strcmp( argv[a], "-F" ) == 0 && a + 1 < argc )
+			{
+				profilePath = argv[++ a];
+			}
+			else if( strcmp( argv[a], "-U" ) == 0 && a + 1 < argc )
+			{
+				layoutPath = argv[++ a];
+			}
+			else if( strcmp( argv[a], "-R" ) == 0 && a + 1 < argc )
+			{
+				record = argv[++ a];
+			}
+			else if( strcmp( argv[a], "-P" ) == 0 && a + 1 < argc )
+			{
+				replay = argv[++ a];
 			}
 		}
 
+		if( checked && ( debug || metered ) )
+		{
+			// those run on the ops, which do not check
+			cout << "-c can not be used with -d or -M" << endl;
+			return statusError;
+		}
 
+		string data_byte_code;
+		if( !readProgram( argv[1], data_byte_code ) )
+		{
+			return 1;
+		}
 
 		Vm vm;
+		Memoizer memoizer;
+		Metrics metrics;
+		Tier tier;
+		Profile profile;
+		RecordIo recordIo;
+		ReplayIo replayIo;
+
+		if( record && !recordIo.open( record ) )
+		{
+			cerr << "can not write " << record << endl;
+			return 1;
+		}
+		if( replay && !replayIo.load( replay ) )
+		{
+			cerr << replay << " is no input log" << endl;
+			return 1;
+		}
+		if( record && !metered )
+		{
+			// the log wants instruction counts, the charges give them
+			limits.counted = true;
+			limited = true;
+		}
 
 		if( debug )
 		{
 			vm.debug = true;
 		}
+		vm.checked = checked;
 
 		vm.buildOps( data_byte_code );
-		vm.buildLabels();
+		if( !vm.buildLabels() )
+		{
+			cerr << "label defined twice" << endl;
+			return statusError;
+		}
+
+		if( optimize )
+		{
+			Optimizer optimizer;
+			optimizer.run( vm );
+			if( stats )
+			{
+				optimizer.dump( cerr );
+			}
+		}
+
+		if( memoize )
+		{
+			memoizer.run( vm );
+		}
+
+		if( layoutPath )
+		{
+			Profile used;
+			if( !used.read( layoutPath ) )
+			{
+				cerr << layoutPath << " is no profile" << endl;
+				return 1;
+			}
+			if( !used.layout( vm ) )
+			{
+				cerr << layoutPath << " is the profile of another program, the layout stays" << endl;
+			}
+			else if( stats )
+			{
+				used.dump( cerr );
+			}
+		}
+
+		if( profilePath )
+		{
+			profile.collect( vm );
+		}
+
+		if( limited )
+		{
+			limits.apply( vm );
+		}
+
+		// the trace and the counts are of ops, so those runs stay on them
+		if( registers && !debug && !metered )
+		{
+			vm.buildIr();
+			if( stats )
+			{
+				cerr << "promoted heap cells: " << vm.ir->loadsPromoted << " retrives, "
+					<< vm.ir->storesPromoted << " stores" << endl;
+				if( checked )
+				{
+					int ops = vm.ir->arithmeticOps;
+					cerr << "overflow checks elided: " << vm.ir->provenOps << " of " << ops
+						<< " arithmetic ops (" << ( ops ? 100 * vm.ir->provenOps / ops : 100 ) << "%)" << endl;
+				}
+			}
+		}
+		else if( tiered && !debug && !metered )
+		{
+			tier.apply( vm );
+		}
+
+		if( nonBlocking )
+		{
+#ifndef WIN32
+			// same program, but run as a session of a Reactor on stdin/stdout
+			cout.flush();
+			Reactor reactor;
+			Session session( &vm, 0, 1 );
+			reactor.add( &session );
+			if( replay )
+			{
+				replayIo.attach( vm );
+			}
+			if( record )
+			{
+				recordIo.attach( vm );
+			}
+			if( metered )
+			{
+				metrics.attach( vm );
+			}
+			reactor.loop();
+#else
+			cout << "-n is not supported on this platform" << endl;
+#endif
+		}
+		else
+		{
+			if( replay )
+			{
+				replayIo.attach( vm );
+			}
+			if( record )
+			{
+				recordIo.attach( vm );
+			}
+			if( metered )
+			{
+				metrics.attach( vm );
+			}
+			vm.run();
+		}
+
+		if( profilePath && !profile.write( profilePath ) )
+		{
+			cerr << "can not write " << profilePath << endl;
+		}
+
+		if( replay && !replayIo.same() )
+		{
+			cerr << "replay: the program read " << replayIo.next + replayIo.missing << " inputs, "
+				<< replayIo.inputs.size() << " in the log, " << replayIo.mismatched << " of another kind" << endl;
+		}
 
-		vm.run();
+		if( stats )
+		{
+			memoizer.dump( cerr );
+			if( tiered && !debug && !metered && !registers )
+			{
+				tier.dump( cerr );
+			}
+		}
+		if( metered )
+		{
+			metrics.print( cerr );
+		}
+
+		if( vm.error )
+		{
+			return Limits::statusOf( vm.error );
+		}
 
 //		cout << "done" << endl;
 
@@ -89,5 +89,89 @@ SOURCE=.\inter.cpp
 
 SOURCE=.\Ops.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\Io.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Reactor.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Server.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Arena.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Stack.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Labels.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Ir.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Cfg.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Optimizer.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Ranges.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Memo.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Semantics.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Constexpr.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Assembler.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Linker.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Metrics.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Limits.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Replay.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Tier.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Layout.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Pipeline.h
+# End Source File
 # End Target
 # End Project